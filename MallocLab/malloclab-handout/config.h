@@ -108,6 +108,13 @@
  */
 #define MAX_HEAP (100*(1<<20))  /* 100 MB */
 
+/*
+ * Heap size memlib-os.c reserves for a real process under libmm.so. It
+ * is only address space until touched, and mm.c's 32-bit free list
+ * offsets and mem_sbrk's int increments keep it below 2 GB.
+ */
+#define OS_MAX_HEAP (2047UL*(1<<20))  /* 2 GB less 1 MB */
+
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
@@ -7,9 +7,14 @@
  * Copyright (c) 2004-2015, R. Bryant and D. O'Hallaron, All rights
  * reserved.  May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE         /* for sched_setaffinity */
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <float.h>
+#include <malloc.h>         /* for memalign */
+#include <pthread.h>
+#include <sched.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -18,12 +23,18 @@
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "clock.h"
+#include "perfctr.h"
 #include "config.h"
+#include "tracefmt.h"
 
 /**********************
  * Constants and macros
@@ -34,6 +45,18 @@
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
+/* Latency histograms (-L): each power of two of cycles is split into
+   2^LAT_SUB_BITS buckets, so a percentile is off by at most 1/16 */
+#define LAT_SUB_BITS  4
+#define LAT_BUCKETS   (64 << LAT_SUB_BITS)
+#define LAT_TYPES     7      /* one histogram per request type */
+
+/* Hardware counters (-H): average over this many replays */
+#define PERFCTR_RUNS  3
+
+/* Skip list of payload ranges: enough levels for 2^RANGE_LEVELS blocks */
+#define RANGE_LEVELS  24
+
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned long)(p)) % ALIGNMENT) == 0)
 
@@ -43,6 +66,13 @@
 #define WUTIL 2
 #define WPERF 3
 
+/* Parallel evaluation (-j): CPUs the workers may be pinned to (-C) */
+#define MAX_PIN_CPUS       256
+
+/* Multi-threaded replay: odd ids are freed by the neighbouring thread */
+#define MT_REPS            3      /* take the best of this many runs */
+#define MT_XFREE(index)    ((index) & 1)
+
 /******************************
  * The key compound data types
  *****************************/
@@ -54,32 +84,33 @@
  * Remember that index (-1) is the null pointer.
  */
 
-/* Records the extent of each block's payload */
+/*
+ * Records the extent of each block's payload. The ranges of a trace form
+ * a skip list in address order, headed by a sentinel whose lo is NULL
+ * and which has all RANGE_LEVELS links. next[0] links every range.
+ */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
     int index;             /* same index as free; for debugging */
+    int levels;            /* number of links in next */
+    struct range_t *next[]; /* next range on each level */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum { ALLOC, FREE, REALLOC } type; /* type of request */
-    int index;                        /* index for free() to use later */
-    size_t size;                      /* byte size of alloc/realloc request */
-} traceop_t;
-
 /* Holds the information for one trace file*/
 typedef struct {
     char filename[MAXLINE];
-    int ignore_ranges;   /* don't check ranges (i.e. this is too big) */
+    int ignore_ranges;   /* unused: every trace gets the overlap check */
     int num_ids;         /* number of alloc/realloc ids */
     int num_ops;         /* number of distinct requests */
     int weight;          /* weight for this trace (unused) */
     traceop_t *ops;      /* array of requests */
+    char *map;           /* mapping ops lies in, for a binary trace */
+    size_t map_len;      /* length of that mapping */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
     int *block_rand_base;/* index into random_data, if debug is on */
+    char **batch;        /* room for the blocks of the largest batch */
 } trace_t;
 
 /*
@@ -92,6 +123,47 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/*
+ * Shared state for a multi-threaded replay (-T). Every thread replays the
+ * whole trace on its own set of blocks, so thread t's copy of block i is
+ * blocks[t*num_ids + i]. done[] counts the completed requests on each
+ * block; a request that is the k-th one on its block waits until done
+ * reaches k, which orders cross-thread frees after the matching malloc.
+ */
+typedef struct {
+    trace_t *trace;
+    int nthreads;
+    char **blocks;       /* nthreads * num_ids block pointers */
+    int *done;           /* nthreads * num_ids completed request counts */
+    int *seq;            /* per request: its position among its block's requests */
+    volatile int failed; /* set when a thread cannot finish its replay */
+    pthread_barrier_t start;
+} mt_replay_t;
+
+/*
+ * Shared between the parent and the worker processes of a parallel
+ * evaluation (-j). Workers claim traces by bumping next, and write their
+ * results straight into the shared stats array.
+ */
+typedef struct {
+    int next;            /* next trace no worker has claimed yet */
+    int errors;          /* errors found by all the workers */
+} par_state_t;
+
+/* One replay thread */
+typedef struct {
+    mt_replay_t *replay;
+    int tid;
+    double secs;         /* time this thread spent replaying */
+    pthread_t thread;
+} mt_worker_t;
+
+/* Latency percentiles of one request type in one trace, in ns */
+typedef struct {
+    unsigned long n;     /* requests of this type */
+    double p50, p99, p999, max;
+} lat_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* set in read_trace */
@@ -105,6 +177,15 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    size_t peak_heap;  /* largest heap size during the util run (0 for libc) */
+    size_t final_heap; /* heap size at the end of the util run */
+    size_t sbrks;      /* mem_sbrk calls during the util run */
+    size_t trimmed;    /* bytes an mm_trim call released on average (-M) */
+    lat_t lat[LAT_TYPES]; /* per-request latencies by type (-L) */
+    perfctr_t hw;      /* hardware counters per replay (-H) */
+#ifdef MM_STATS
+    mm_stats_t alloc;  /* allocator counters from the util run */
+#endif
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
@@ -141,6 +222,25 @@ int verbose = 1;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
 int onetime_flag = 0;
 
+#ifdef MM_STATS
+static int stats_flag = 0; /* print the allocator counters (-S) */
+#endif
+
+static int lat_flag = 0;   /* time every request on its own (-L) */
+static int unbatch = 0;    /* replay batched requests one by one (-U) */
+static int hw_flag = 0;    /* count hardware events in the replays (-H) */
+
+/* Call mm_trim every trim_interval requests of the util run (-M) */
+static int trim_interval = 0;
+
+/* Fragmentation timeline (-F), a CSV row every frag_interval requests */
+static int frag_fd = -1;
+static int frag_interval = 1000;
+
+/* CPUs the timing runs are pinned to (-C), none by default */
+static int pin_cpus[MAX_PIN_CPUS];
+static int num_pin_cpus = 0;
+
 /* by default, no timeouts */
 static int set_timeout = 0;
 
@@ -167,30 +267,64 @@ static int add_range(range_t **ranges, char *lo, int size,
                      const trace_t *trace, int opnum, int index);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
+static void find_range(range_t **ranges, char *lo, range_t **update);
+static int range_level(void);
 
 /* These functions implement the debugging code */
 static void init_random_data(void);
 static void check_index(const trace_t *trace, int opnum, int index);
 static void randomize_block(trace_t *trace, int index);
+static int is_zero(const char *p, size_t size);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(stats_t *stats, const char *tracedir,
                            const char *filename);
+static void read_text_trace(trace_t *trace, FILE *tracefile);
+static void check_requests(trace_t *trace);
+static void map_trace(trace_t *trace, int fd, const tracehdr_t *hdr);
+static void write_trace(const trace_t *trace, const char *filename);
 static void reinit_trace(trace_t *trace);
 static void free_trace(trace_t *trace);
+static inline const traceop_t *aligned_by(const trace_t *trace, int i);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace);
 static void eval_libc_speed(void *ptr);
+static void *libc_aligned(const traceop_t *a, size_t size);
 
 /* Routines for evaluating correctnes, space utilization, and speed
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum);
+static void *mm_aligned(const traceop_t *a, size_t size);
+static double eval_mm_util(trace_t *trace, int tracenum, size_t *peak_heap,
+                           size_t *final_heap, size_t *sbrks, size_t *trimmed);
+static void write_frag_header(void);
+static void write_frag_row(trace_t *trace, int op, int live);
 static void eval_mm_speed(void *ptr);
+static int valid_batch(trace_t *trace, int i, range_t **ranges);
+static void replay_batch(trace_t *trace, int i);
+static void eval_mm_latency(trace_t *trace, lat_t *lat);
+
+/* Routines for replaying a trace on several threads at once */
+static void run_par_tests(int num_tracefiles, const char *tracedir,
+                          char **tracefiles, stats_t *mm_stats,
+                          range_t *ranges, speed_t *speed_params, int njobs);
+static void pin_cpu(int worker);
+static void parse_cpus(const char *list);
+static void run_mt_tests(int num_tracefiles, const char *tracedir,
+                         char **tracefiles, int nthreads);
+static int eval_mm_mt(trace_t *trace, int nthreads, double *secs,
+                      double *thread_secs);
+static void *eval_mm_mt_thread(void *ptr);
+static double wall_secs(void);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats, sum_stats_t *sumstats);
+static void print_latency(int n, stats_t *stats);
+static void print_hw(const stats_t *stats);
+#ifdef MM_STATS
+static void print_alloc_stats(int n, stats_t *stats);
+#endif
 static void usage(void);
 static void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
     __attribute__((format(printf, 3,4)));
@@ -208,15 +342,24 @@ static void timeout_handler(int sig __attribute__((unused))) {
     longjmp(timeout_jmpbuf, 1);
 }
 
+/* The trace to run after trace i: the next one, or the next unclaimed
+   one when several workers share the counter *next */
+static int next_trace(int *next, int i)
+{
+    return next ? __atomic_fetch_add(next, 1, __ATOMIC_RELAXED) : i + 1;
+}
+
 /* Run the tests; return the number of tests run (may be less than
    num_tracefiles, if there's a timeout) */
 static void run_tests(int num_tracefiles, const char *tracedir,
                       char **tracefiles, 
-                      stats_t *mm_stats, range_t *ranges, speed_t *speed_params) {
+                      stats_t *mm_stats, range_t *ranges, speed_t *speed_params,
+                      int *next) {
     volatile int i;
     volatile int timed_out = 0;
 
-    for (i=0; i < num_tracefiles; i++) {
+    for (i = next_trace(next, -1); i < num_tracefiles;
+         i = next_trace(next, i)) {
         /* initialize simulated memory system in memlib.c *
          * start each trace with a clean system */
         mem_init();
@@ -245,12 +388,23 @@ static void run_tests(int num_tracefiles, const char *tracedir,
         if (mm_stats[i].valid) {
             if (verbose > 1)
                 printf("efficiency, ");
-            mm_stats[i].util = eval_mm_util(trace, i);
+            mm_stats[i].util = eval_mm_util(trace, i, &mm_stats[i].peak_heap,
+                                            &mm_stats[i].final_heap,
+                                            &mm_stats[i].sbrks,
+                                            &mm_stats[i].trimmed);
+#ifdef MM_STATS
+            mm_get_stats(&mm_stats[i].alloc);
+#endif
             speed_params->trace = trace;
             speed_params->ranges = ranges;
             if (verbose > 1)
                 printf("and performance.\n");
             mm_stats[i].secs = fsecs(eval_mm_speed, speed_params);
+            if (hw_flag)
+                perfctr_measure(eval_mm_speed, speed_params, PERFCTR_RUNS,
+                                &mm_stats[i].hw);
+            if (lat_flag)
+                eval_mm_latency(trace, mm_stats[i].lat);
         }
 
         free_trace(trace);
@@ -260,6 +414,159 @@ static void run_tests(int num_tracefiles, const char *tracedir,
     }
 }
 
+/*
+ * run_par_tests - Evaluate the traces in njobs worker processes. Each
+ *     worker has its own memlib heap and claims traces one at a time,
+ *     and mm_stats must be shared memory so the parent sees the results.
+ */
+static void run_par_tests(int num_tracefiles, const char *tracedir,
+                          char **tracefiles, stats_t *mm_stats,
+                          range_t *ranges, speed_t *speed_params, int njobs)
+{
+    par_state_t *par;
+    pid_t pid;
+    int k, status;
+
+    par = mmap(NULL, sizeof(par_state_t), PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (par == MAP_FAILED)
+        unix_error("mmap failed in run_par_tests");
+    par->next = 0;
+    par->errors = 0;
+
+    for (k = 0; k < njobs; k++) {
+        if ((pid = fork()) < 0)
+            unix_error("fork failed in run_par_tests");
+        if (pid == 0) {
+            pin_cpu(k);
+            if (set_timeout > 0)
+                alarm(set_timeout);   /* alarms are not inherited */
+            run_tests(num_tracefiles, tracedir, tracefiles, mm_stats,
+                      ranges, speed_params, &par->next);
+            __atomic_add_fetch(&par->errors, errors, __ATOMIC_RELAXED);
+            _exit(0);
+        }
+    }
+
+    /* A worker that died left its traces marked invalid */
+    while ((pid = wait(&status)) > 0) {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "Worker %d failed\n", (int)pid);
+            errors++;
+        }
+    }
+    errors += par->errors;
+    munmap(par, sizeof(par_state_t));
+}
+
+/*
+ * pin_cpu - Pin the calling process to its CPU from the -C list, if any
+ */
+static void pin_cpu(int worker)
+{
+    cpu_set_t set;
+
+    if (num_pin_cpus == 0)
+        return;
+    CPU_ZERO(&set);
+    CPU_SET(pin_cpus[worker % num_pin_cpus], &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0)
+        unix_error("Could not pin to CPU %d", pin_cpus[worker % num_pin_cpus]);
+}
+
+/*
+ * parse_cpus - Parse a CPU list such as "2,3,6-9" into pin_cpus
+ */
+static void parse_cpus(const char *list)
+{
+    const char *p = list;
+    char *end;
+    long lo, hi;
+
+    num_pin_cpus = 0;
+    while (*p != '\0') {
+        lo = hi = strtol(p, &end, 10);
+        if (end == p)
+            app_error("Bad CPU list %s\n", list);
+        if (*end == '-') {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+            if (end == p)
+                app_error("Bad CPU list %s\n", list);
+        }
+        if (lo < 0 || hi < lo || hi >= CPU_SETSIZE)
+            app_error("Bad CPU range in %s\n", list);
+        for (; lo <= hi && num_pin_cpus < MAX_PIN_CPUS; lo++)
+            pin_cpus[num_pin_cpus++] = lo;
+        p = (*end == ',') ? end + 1 : end;
+        if (*end != ',' && *end != '\0')
+            app_error("Bad CPU list %s\n", list);
+    }
+}
+
+/*
+ * run_mt_tests - Replay each trace on one thread and then on nthreads
+ *     threads against the same heap, and report the aggregate and
+ *     per-thread throughput and the scaling efficiency.
+ */
+static void run_mt_tests(int num_tracefiles, const char *tracedir,
+                         char **tracefiles, int nthreads)
+{
+    int i, t;
+    stats_t stats;
+    double secs1, secsn, tput1, tputn;
+    double *thread_secs;
+    size_t peak;
+
+    if ((thread_secs = calloc(nthreads, sizeof(double))) == NULL)
+        unix_error("thread_secs calloc in run_mt_tests failed");
+
+    printf("\nMulti-threaded replay with %d threads "
+           "(odd ids freed by the neighbouring thread):\n", nthreads);
+    printf("%8s%10s%10s%8s  %s\n",
+           "ops", "Kops(1)", "Kops(N)", "scale", "trace");
+
+    for (i = 0; i < num_tracefiles; i++) {
+        mem_init();
+        trace_t *trace = read_trace(&stats, tracedir, tracefiles[i]);
+
+        if (trace->weight == WUTIL) {
+            free_trace(trace);
+            mem_deinit();
+            continue;
+        }
+        /* Every thread replays its own copy of the trace in one heap */
+        if (!eval_mm_mt(trace, 1, &secs1, thread_secs)) {
+            printf("%8d%10s%10s%8s  %s (out of memory)\n",
+                   trace->num_ops, "-", "-", "-", trace->filename);
+        } else if ((peak = mem_peak_heapsize()) > (size_t)MAX_HEAP / nthreads) {
+            printf("%8d%10s%10s%8s  %s (skipped: %d copies need %zu MB, "
+                   "more than the %d MB heap)\n", trace->num_ops, "-", "-",
+                   "-", trace->filename, nthreads, nthreads * peak >> 20,
+                   MAX_HEAP >> 20);
+        } else if (!eval_mm_mt(trace, nthreads, &secsn, thread_secs)) {
+            printf("%8d%10s%10s%8s  %s (out of memory with %d copies)\n",
+                   trace->num_ops, "-", "-", "-", trace->filename, nthreads);
+        } else {
+            tput1 = trace->num_ops / secs1;
+            tputn = (double)nthreads * trace->num_ops / secsn;
+            printf("%8d%10.0f%10.0f%7.0f%%  %s\n", trace->num_ops,
+                   tput1 / 1e3, tputn / 1e3,
+                   100.0 * tputn / (nthreads * tput1), trace->filename);
+            if (verbose > 1) {
+                printf("%28s", "per-thread Kops:");
+                for (t = 0; t < nthreads; t++)
+                    printf(" %.0f", trace->num_ops / thread_secs[t] / 1e3);
+                printf("\n");
+            }
+        }
+
+        free_trace(trace);
+        mem_deinit();
+    }
+    free(thread_secs);
+}
+
 /**************
  * Main routine
  **************/
@@ -276,7 +583,12 @@ int main(int argc, char **argv)
     speed_t speed_params;      /* input parameters to the xx_speed routines */
 
     int run_libc = 0;     /* If set, run libc malloc (set by -l) */
+    char *write_file = NULL; /* If set, convert the -f trace to it (-w) */
+    int mt_threads = 0;   /* If set, replay on this many threads (-T) */
+    int njobs = 1;        /* Worker processes evaluating traces (-j) */
     int autograder = 0;   /* if set then called by autograder (-A) */
+    int backing = -1;     /* If set, back the heap this way (-B) */
+    int release = 0;      /* If set, release heap pages at every reset (-R) */
     int checkpoint = 0;
 
     /* temporaries used to compute the performance index */
@@ -291,7 +603,7 @@ int main(int argc, char **argv)
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hpVAlD")) != EOF) {
+    while ((c = getopt(argc, argv, "d:f:c:j:k:m:s:t:v:B:C:F:M:T:w:hpRUVAlDHLS")) != EOF) {
         switch (c) {
 
         case 'A': /* Hidden Autolab driver argument */
@@ -352,6 +664,85 @@ int main(int argc, char **argv)
             set_timeout = atoi(optarg);
             break;
 
+        case 'm': /* Requests of at least this size get their own mapping */
+            mm_set_mmap_threshold(strtoul(optarg, NULL, 0));
+            break;
+
+        case 'B': /* Back the heap with huge pages or lazily committed memory */
+            for (backing = 0; mem_backing_name(backing) != NULL; backing++)
+                if (strcmp(optarg, mem_backing_name(backing)) == 0)
+                    break;
+            if (mem_backing_name(backing) == NULL)
+                app_error("-B takes devzero, noreserve, thp or hugetlb\n");
+            break;
+
+        case 'R': /* Give the heap pages back at every heap reset */
+            release = 1;
+            break;
+
+        case 'U': /* Replay batched requests one at a time */
+            unbatch = 1;
+            break;
+
+        case 'j': /* Evaluate traces in several worker processes */
+            njobs = atoi(optarg);
+            if (njobs == 0)
+                njobs = sysconf(_SC_NPROCESSORS_ONLN);
+            if (njobs < 1)
+                app_error("-j needs a positive worker count\n");
+            break;
+
+        case 'C': /* Pin the timing runs to these CPUs */
+            parse_cpus(optarg);
+            break;
+
+        case 'T': /* Replay each trace on several threads */
+            mt_threads = atoi(optarg);
+            if (mt_threads < 1)
+                app_error("-T needs a positive thread count\n");
+            break;
+
+        case 'w': /* Write the trace in binary format and exit */
+            write_file = optarg;
+            break;
+
+        case 'H': /* Count hardware events in the timed replays */
+            hw_flag = 1;
+            if (perfctr_probe() == 0)
+                fprintf(stderr, "No hardware counters available\n");
+            break;
+
+        case 'F': /* Write a fragmentation timeline to a CSV file */
+            if ((frag_fd = open(optarg, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+                                0644)) < 0)
+                unix_error("Could not open the -F file");
+            write_frag_header();
+            break;
+
+        case 'k': /* Requests between two rows of the -F timeline */
+            frag_interval = atoi(optarg);
+            if (frag_interval < 1)
+                app_error("-k needs a positive request count\n");
+            break;
+
+        case 'M': /* Call mm_trim every n requests of the util run */
+            trim_interval = atoi(optarg);
+            if (trim_interval < 1)
+                app_error("-M needs a positive request count\n");
+            break;
+
+        case 'L': /* Report per-request latency percentiles */
+            lat_flag = 1;
+            break;
+
+        case 'S': /* Print the allocator counters of each trace */
+#ifdef MM_STATS
+            stats_flag = 1;
+#else
+            app_error("-S needs the stats build (make mdriver-stats)\n");
+#endif
+            break;
+
         case 'h': /* Print this message */
             usage();
             exit(0);
@@ -362,6 +753,19 @@ int main(int argc, char **argv)
         }
     }
 
+    if (write_file != NULL) {
+        stats_t stats;
+        trace_t *trace;
+
+        if (tracefiles == NULL)
+            app_error("-w needs a trace given with -f\n");
+        trace = read_trace(&stats, tracedir, tracefiles[0]);
+        write_trace(trace, write_file);
+        printf("Wrote %d requests to %s\n", trace->num_ops, write_file);
+        free_trace(trace);
+        exit(0);
+    }
+
     if (tracefiles == NULL) {
         tracefiles = default_tracefiles;
         num_tracefiles = sizeof(default_tracefiles) / sizeof(char *) - 1;
@@ -372,6 +776,15 @@ int main(int argc, char **argv)
         init_random_data();
     }
 
+    /* Tell which backing the heap really got, after any fallback */
+    if (backing >= 0 || release) {
+        mem_set_backing(backing >= 0 ? backing : MEM_DEVZERO, release);
+        mem_init();
+        printf("Heap backing: %s%s\n", mem_backing_name(mem_backing()),
+               release ? ", pages released at every reset" : "");
+        mem_deinit();
+    }
+
     /* Initialize the timing package */
     init_fsecs();
 
@@ -381,6 +794,17 @@ int main(int argc, char **argv)
         alarm(set_timeout); 
     }
 
+    /*
+     * The multi-threaded replay is a separate measurement: no grading
+     */
+    if (mt_threads) {
+        if (!mm_thread_safe)
+            app_error("-T needs the thread-safe build of mm.c: "
+                      "use mdriver-ts\n");
+        run_mt_tests(num_tracefiles, tracedir, tracefiles, mt_threads);
+        exit(0);
+    }
+
     /*
      * Optionally run and evaluate the libc malloc package
      */
@@ -405,6 +829,9 @@ int main(int argc, char **argv)
                 if (verbose > 1)
                     printf("and performance.\n");
                 libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+                if (hw_flag)
+                    perfctr_measure(eval_libc_speed, &speed_params,
+                                    PERFCTR_RUNS, &libc_stats[i].hw);
             }
             free_trace(trace);
         }
@@ -423,13 +850,26 @@ int main(int argc, char **argv)
     if (verbose > 1)
         printf("\nTesting mm malloc\n");
 
-    /* Allocate the mm stats array, with one stats_t struct per tracefile */
-    mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
-    if (mm_stats == NULL)
-        unix_error("mm_stats calloc in main failed");
-
-    run_tests(num_tracefiles, tracedir, tracefiles, mm_stats,
-              ranges, &speed_params);
+    /* Allocate the mm stats array, with one stats_t struct per tracefile.
+       Worker processes write their results to it, so it is shared */
+    if (njobs > 1 && !onetime_flag) {
+        mm_stats = mmap(NULL, num_tracefiles * sizeof(stats_t),
+                        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                        -1, 0);
+        if (mm_stats == MAP_FAILED)
+            unix_error("mm_stats mmap in main failed");
+        if (verbose > 1)
+            printf("Evaluating traces in %d worker processes\n", njobs);
+        run_par_tests(num_tracefiles, tracedir, tracefiles, mm_stats,
+                      ranges, &speed_params, njobs);
+    } else {
+        mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+        if (mm_stats == NULL)
+            unix_error("mm_stats calloc in main failed");
+        pin_cpu(0);
+        run_tests(num_tracefiles, tracedir, tracefiles, mm_stats,
+                  ranges, &speed_params, NULL);
+    }
 
 
     /* Display the mm results in a compact table */
@@ -445,6 +885,12 @@ int main(int argc, char **argv)
             printf("\nResults for mm malloc:\n");
             printresults(num_tracefiles, mm_stats, &global_mm_sum_stats);
             printf("\n");
+            if (lat_flag)
+                print_latency(num_tracefiles, mm_stats);
+#ifdef MM_STATS
+            if (stats_flag)
+                print_alloc_stats(num_tracefiles, mm_stats);
+#endif
         }
     }
 
@@ -595,7 +1041,9 @@ static int add_range(range_t **ranges, char *lo, int size,
                      const trace_t *trace, int opnum, int index)
 {
     char *hi = lo + size - 1;
-    range_t *p;
+    range_t *update[RANGE_LEVELS];
+    range_t *p, *prev, *next;
+    int level;
 
     assert(size > 0);
 
@@ -606,42 +1054,53 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
-        (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap, or of one
+       of the mappings handed out by mem_map */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
+         (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+        !mem_is_mapped(lo, size)) {
         malloc_error(trace, opnum,
                      "Payload (%p:%p) lies outside heap (%p:%p)",
                      lo, hi, mem_heap_lo(), mem_heap_hi());
         return 0;
     }
 
-    /* If we can't afford the linear-time loop, we check less thoroughly and
-       just assume the overlap will be caught by writing random bits. */
-    if(trace->ignore_ranges || debug_mode == DBG_NONE) return 1;
-
+    if(debug_mode == DBG_NONE) return 1;
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-            malloc_error(trace, opnum,
-                         "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-                         lo, hi, p->lo, p->hi);
-            return 0;
-        }
+    /* The payload must not overlap any other payloads: only its
+       neighbours in address order can overlap it */
+    find_range(ranges, lo, update);
+    prev = update[0];
+    next = prev->next[0];
+    if (prev != *ranges && prev->hi >= lo) {
+        malloc_error(trace, opnum,
+                     "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+                     lo, hi, prev->lo, prev->hi);
+        return 0;
+    }
+    if (next != NULL && next->lo <= hi) {
+        malloc_error(trace, opnum,
+                     "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+                     lo, hi, next->lo, next->hi);
+        return 0;
     }
 
     /*
      * Everything looks OK, so remember the extent of this block
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and linking it in after prev.
      */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
+    level = range_level();
+    if ((p = (range_t *)malloc(sizeof(range_t) +
+                               level * sizeof(range_t *))) == NULL)
         unix_error("malloc error in add_range");
-    p->next = *ranges;
     p->lo = lo;
     p->hi = hi;
     p->index = index;
-    *ranges = p;
+    p->levels = level;
+    while (level-- > 0) {
+        p->next[level] = update[level]->next[level];
+        update[level]->next[level] = p;
+    }
 
     return 1;
 }
@@ -651,17 +1110,19 @@ static int add_range(range_t **ranges, char *lo, int size,
  */
 static void remove_range(range_t **ranges, char *lo)
 {
+    range_t *update[RANGE_LEVELS];
     range_t *p;
-    range_t **prevpp = ranges;
-
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-            *prevpp = p->next;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
-    }
+    int level;
+
+    if (*ranges == NULL)
+        return;
+    find_range(ranges, lo, update);
+    p = update[0]->next[0];
+    if (p == NULL || p->lo != lo)
+        return;
+    for (level = 0; level < p->levels; level++)
+        update[level]->next[level] = p->next[level];
+    free(p);
 }
 
 /*
@@ -673,12 +1134,54 @@ static void clear_ranges(range_t **ranges)
     range_t *pnext;
 
     for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
+        pnext = p->next[0];
         free(p);
     }
     *ranges = NULL;
 }
 
+/*
+ * find_range - Store in update[l] the last range on level l that starts
+ *     below lo, the sentinel if there is none. Creates the sentinel of
+ *     an empty range list.
+ */
+static void find_range(range_t **ranges, char *lo, range_t **update)
+{
+    range_t *p;
+    int level;
+
+    if (*ranges == NULL) {
+        p = calloc(1, sizeof(range_t) + RANGE_LEVELS * sizeof(range_t *));
+        if (p == NULL)
+            unix_error("malloc error in find_range");
+        p->levels = RANGE_LEVELS;
+        *ranges = p;
+    }
+    p = *ranges;
+    for (level = RANGE_LEVELS - 1; level >= 0; level--) {
+        while (p->next[level] != NULL && p->next[level]->lo < lo)
+            p = p->next[level];
+        update[level] = p;
+    }
+}
+
+/*
+ * range_level - Number of links for a new range: level l is used with
+ *     probability 2^-l
+ */
+static int range_level(void)
+{
+    static unsigned int state = 2463534242u;  /* xorshift32 */
+    int level = 1;
+
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    while (level < RANGE_LEVELS && (state >> (level - 1) & 1))
+        level++;
+    return level;
+}
+
 /**********************************************
  * The following routines handle the random data used for
  * checking memory access.
@@ -741,6 +1244,18 @@ static void check_index(const trace_t *trace, int opnum, int index) {
     }
 }
 
+/*
+ * is_zero - Check that the size bytes at p all read as zero
+ */
+static int is_zero(const char *p, size_t size) {
+    size_t i;
+
+    for(i = 0; i < size; i++) {
+        if(p[i] != 0) return 0;
+    }
+    return 1;
+}
+
 /**********************************************
  * The following routines manipulate tracefiles
  *********************************************/
@@ -753,40 +1268,34 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
 {
     FILE *tracefile;
     trace_t *trace;
-    char type[MAXLINE];
-    int index, size;
-    int max_index = 0;
-    int op_index;
+    tracehdr_t hdr;
+    int fd;
 
     if (verbose > 1)
         printf("Reading tracefile: %s\n", filename);
 
     /* Allocate the trace record */
-    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
+    if ((trace = (trace_t *) calloc(1, sizeof(trace_t))) == NULL)
         unix_error("malloc 1 failed in read_trace");
 
-    /* Read the trace file header */
+    /* A binary trace starts with its magic number, a text one with digits */
     strcpy(trace->filename, tracedir);
     strcat(trace->filename, filename);
-    if ((tracefile = fopen(trace->filename, "r")) == NULL) {
+    if ((fd = open(trace->filename, O_RDONLY)) < 0) {
         unix_error("Could not open %s in read_trace", trace->filename);
     }
-    fscanf(tracefile, "%d", &trace->weight);
-    fscanf(tracefile, "%d", &trace->num_ids);
-    fscanf(tracefile, "%d", &trace->num_ops);
-    fscanf(tracefile, "%d", &trace->ignore_ranges);
-
-    if(trace->weight < 0 || trace->weight > 3) {
-        app_error("%s: weight can only be in {0, 1, 2 3}", trace->filename);
-    }
-    if(trace->ignore_ranges != 0 && trace->ignore_ranges != 1) {
-        app_error("%s: ignore-ranges can only be zero or one", trace->filename);
+    if (read(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+        hdr.magic == TRACE_MAGIC) {
+        map_trace(trace, fd, &hdr);
+        close(fd);
+    } else {
+        if (lseek(fd, 0, SEEK_SET) < 0 ||
+            (tracefile = fdopen(fd, "r")) == NULL)
+            unix_error("Could not read %s in read_trace", trace->filename);
+        read_text_trace(trace, tracefile);
+        fclose(tracefile);
     }
-
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops =
-         (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-        unix_error("malloc 2 failed in read_trace");
+    check_requests(trace);
 
     /* We'll keep an array of pointers to the allocated blocks here... */
     if ((trace->blocks =
@@ -803,6 +1312,52 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
          calloc(trace->num_ids, sizeof(*trace->block_rand_base))) == NULL)
         unix_error("malloc 5 failed in read_trace");
 
+    /* fill in the stats */
+    strcpy(stats->filename, trace->filename);
+    stats->weight = trace->weight;
+    stats->ops = trace->num_ops;
+
+    return trace;
+}
+
+/*
+ * check_trace_header - Reject header values the driver cannot replay
+ */
+static void check_trace_header(const trace_t *trace)
+{
+    if(trace->weight < 0 || trace->weight > 3) {
+        app_error("%s: weight can only be in {0, 1, 2 3}", trace->filename);
+    }
+    if(trace->ignore_ranges != 0 && trace->ignore_ranges != 1) {
+        app_error("%s: ignore-ranges can only be zero or one", trace->filename);
+    }
+    if(trace->num_ids < 0 || trace->num_ids > TRACE_MAX_IDS ||
+       trace->num_ops < 0) {
+        app_error("%s: bad id or request count", trace->filename);
+    }
+}
+
+/*
+ * read_text_trace - Parse a text trace into a malloc'd op array
+ */
+static void read_text_trace(trace_t *trace, FILE *tracefile)
+{
+    char type[MAXLINE];
+    int index, size;
+    int max_index = 0;
+    int op_index;
+
+    /* Read the trace file header */
+    fscanf(tracefile, "%d", &trace->weight);
+    fscanf(tracefile, "%d", &trace->num_ids);
+    fscanf(tracefile, "%d", &trace->num_ops);
+    fscanf(tracefile, "%d", &trace->ignore_ranges);
+    check_trace_header(trace);
+
+    /* We'll store each request line in the trace in this array */
+    if ((trace->ops =
+         (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+        unix_error("malloc 2 failed in read_trace");
 
     /* read every request line in the trace file */
     index = 0;
@@ -816,6 +1371,13 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
             trace->ops[op_index].size = size;
             max_index = (index > max_index) ? index : max_index;
             break;
+        case 'c':
+            fscanf(tracefile, "%u %u", &index, &size);
+            trace->ops[op_index].type = CALLOC;
+            trace->ops[op_index].index = index;
+            trace->ops[op_index].size = size;
+            max_index = (index > max_index) ? index : max_index;
+            break;
         case 'r':
             fscanf(tracefile, "%u %u", &index, &size);
             trace->ops[op_index].type = REALLOC;
@@ -827,6 +1389,28 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
             fscanf(tracefile, "%ud", &index);
             trace->ops[op_index].type = FREE;
             trace->ops[op_index].index = index;
+            trace->ops[op_index].size = 0;
+            break;
+        case 's':
+            fscanf(tracefile, "%u %u", &index, &size);
+            trace->ops[op_index].type = FREE_SIZED;
+            trace->ops[op_index].index = index;
+            trace->ops[op_index].size = size;
+            break;
+        case 'b':
+            fscanf(tracefile, "%u", &size);
+            trace->ops[op_index].type = BATCH;
+            trace->ops[op_index].index = 0;
+            trace->ops[op_index].size = size;
+            break;
+        case 'm':
+        case 'p':
+        case 'A':
+            fscanf(tracefile, "%u", &size);
+            trace->ops[op_index].type = ALIGNED;
+            trace->ops[op_index].index = (type[0] == 'm') ? ALIGN_MEMALIGN :
+                (type[0] == 'p') ? ALIGN_POSIX : ALIGN_ALLOC;
+            trace->ops[op_index].size = size;
             break;
         default:
             app_error("Bogus type character (%c) in tracefile %s\n",
@@ -835,51 +1419,222 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
         op_index++;
         if(op_index == trace->num_ops) break;
     }
-    fclose(tracefile);
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
-
-    /* fill in the stats */
-    strcpy(stats->filename, trace->filename);
-    stats->weight = trace->weight;
-    stats->ops = trace->num_ops;
-
-    return trace;
 }
 
 /*
- * reinit_trace - get the trace ready for another run.
+ * map_trace - Map a binary trace and use its op array in place
  */
-static void reinit_trace(trace_t *trace)
+static void map_trace(trace_t *trace, int fd, const tracehdr_t *hdr)
 {
-    memset(trace->blocks, 0, trace->num_ids * sizeof(*trace->blocks));
-    memset(trace->block_sizes, 0, trace->num_ids * sizeof(*trace->block_sizes));
-    /* block_rand_base is unused if size is zero */
+    struct stat st;
+    int i;
+
+    if (hdr->version < 1 || hdr->version > TRACE_VERSION)
+        app_error("%s: binary trace version %u, expected 1 to %u",
+                  trace->filename, hdr->version, TRACE_VERSION);
+    trace->weight = hdr->weight;
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->ignore_ranges = hdr->ignore_ranges;
+    check_trace_header(trace);
+
+    if (fstat(fd, &st) < 0)
+        unix_error("Could not stat %s in read_trace", trace->filename);
+    trace->map_len = st.st_size;
+    if (trace->map_len !=
+        sizeof(tracehdr_t) + (size_t)trace->num_ops * sizeof(traceop_t))
+        app_error("%s: binary trace has the wrong length", trace->filename);
+
+    /* Fault the pages in now rather than during the timed runs */
+    trace->map = mmap(NULL, trace->map_len, PROT_READ,
+                      MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    if (trace->map == MAP_FAILED)
+        unix_error("Could not map %s in read_trace", trace->filename);
+    trace->ops = (traceop_t *)(trace->map + sizeof(tracehdr_t));
+
+    for (i = 0; i < trace->num_ops; i++) {
+        if (trace->ops[i].type > TRACE_LAST_TYPE(hdr->version) ||
+            (trace->ops[i].type != FREE && trace->ops[i].index < 0) ||
+            (trace->ops[i].type != BATCH && trace->ops[i].type != ALIGNED &&
+             trace->ops[i].index >= trace->num_ids))
+            app_error("%s: bad request %d in binary trace",
+                      trace->filename, i);
+    }
 }
 
 /*
- * free_trace - Free the trace record and the four arrays it points
- *              to, all of which were allocated in read_trace().
+ * check_requests - Reject batches, aligned allocations and sized frees
+ *     the calls they stand for cannot replay, and make room for the
+ *     blocks of the largest batch
  */
-static void free_trace(trace_t *trace)
+static void check_requests(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
-    free(trace->blocks);
-    free(trace->block_sizes);
-    free(trace->block_rand_base);
-    free(trace);              /* and the trace record itself... */
-}
+    traceop_t *ops = trace->ops;
+    uint32_t *sizes;
+    size_t align;
+    int max = 0;
+    int i, k, n;
+
+    /* The size each block has at each point of the trace */
+    if ((sizes = calloc(trace->num_ids + 1, sizeof(*sizes))) == NULL)
+        unix_error("malloc 6 failed in read_trace");
+
+    for (i = 0; i < trace->num_ops; i++) {
+        switch (ops[i].type) {
+        case ALLOC:
+        case CALLOC:
+        case REALLOC:
+            sizes[ops[i].index] = ops[i].size;
+            break;
+
+        case FREE_SIZED:
+            if (ops[i].index < 0 || ops[i].size != sizes[ops[i].index])
+                app_error("%s: sized free %d does not match its block",
+                          trace->filename, i);
+            break;
+
+        case ALIGNED:
+            align = ops[i].size;
+            if (align == 0 || (align & (align - 1)) != 0 ||
+                (ops[i].index == ALIGN_POSIX && align < sizeof(void *)) ||
+                ops[i].index > ALIGN_ALLOC)
+                app_error("%s: bad alignment in request %d",
+                          trace->filename, i);
+            if (i + 1 == trace->num_ops || ops[i + 1].type != ALLOC)
+                app_error("%s: aligned request %d is not an allocation",
+                          trace->filename, i);
+            break;
+
+        case BATCH:
+            n = ops[i].size;
+            if (n < 1 || n > trace->num_ops - i - 1)
+                app_error("%s: batch %d is empty or runs past the end",
+                          trace->filename, i);
+            for (k = i + 1; k <= i + n; k++) {
+                if ((ops[k].type != ALLOC && ops[k].type != FREE) ||
+                    ops[k].type != ops[i + 1].type ||
+                    ops[k].size != ops[i + 1].size)
+                    app_error("%s: batch %d mixes requests",
+                              trace->filename, i);
+            }
+            max = (n > max) ? n : max;
+            break;
+        }
+    }
+    free(sizes);
+    if ((trace->batch = calloc(max + 1, sizeof(char *))) == NULL)
+        unix_error("malloc 7 failed in read_trace");
+}
+
+/*
+ * write_trace - Save a trace in the binary format map_trace reads
+ */
+static void write_trace(const trace_t *trace, const char *filename)
+{
+    tracehdr_t hdr;
+    FILE *out;
+
+    hdr.magic = TRACE_MAGIC;
+    hdr.version = TRACE_VERSION;
+    hdr.weight = trace->weight;
+    hdr.num_ids = trace->num_ids;
+    hdr.num_ops = trace->num_ops;
+    hdr.ignore_ranges = trace->ignore_ranges;
+
+    if ((out = fopen(filename, "wb")) == NULL)
+        unix_error("Could not open %s in write_trace", filename);
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1 ||
+        fwrite(trace->ops, sizeof(traceop_t), trace->num_ops, out) !=
+        (size_t)trace->num_ops ||
+        fclose(out) != 0)
+        unix_error("Could not write %s in write_trace", filename);
+}
+
+/*
+ * reinit_trace - get the trace ready for another run.
+ */
+static void reinit_trace(trace_t *trace)
+{
+    memset(trace->blocks, 0, trace->num_ids * sizeof(*trace->blocks));
+    memset(trace->block_sizes, 0, trace->num_ids * sizeof(*trace->block_sizes));
+    /* block_rand_base is unused if size is zero */
+}
+
+/*
+ * free_trace - Free the trace record and the four arrays it points
+ *              to, all of which were allocated in read_trace().
+ */
+static void free_trace(trace_t *trace)
+{
+    if (trace->map != NULL)   /* unmap or free the ops... */
+        munmap(trace->map, trace->map_len);
+    else
+        free(trace->ops);
+    free(trace->blocks);      /* the three arrays... */
+    free(trace->block_sizes);
+    free(trace->block_rand_base);
+    free(trace->batch);
+    free(trace);              /* and the trace record itself... */
+}
+
+/*
+ * aligned_by - Return the ALIGNED request that makes request i an aligned
+ *     allocation, or NULL if it is a plain mm_malloc
+ */
+static inline const traceop_t *aligned_by(const trace_t *trace, int i)
+{
+    return (i > 0 && trace->ops[i - 1].type == ALIGNED) ?
+        &trace->ops[i - 1] : NULL;
+}
 
 /**********************************************************************
  * The following functions evaluate the correctness, space utilization,
  * and throughput of the libc and mm malloc packages.
  **********************************************************************/
 
+/*
+ * mm_aligned - Make the aligned allocation of size bytes that the
+ *     ALIGNED request a stands for
+ */
+static void *mm_aligned(const traceop_t *a, size_t size)
+{
+    void *p;
+
+    switch (a->index) {
+    case ALIGN_POSIX:
+        return (mm_posix_memalign(&p, a->size, size) == 0) ? p : NULL;
+    case ALIGN_ALLOC:
+        return mm_aligned_alloc(a->size, size);
+    default:
+        return mm_memalign(a->size, size);
+    }
+}
+
+/*
+ * libc_aligned - mm_aligned for the libc malloc package
+ */
+static void *libc_aligned(const traceop_t *a, size_t size)
+{
+    void *p;
+
+    switch (a->index) {
+    case ALIGN_POSIX:
+        return (posix_memalign(&p, a->size, size) == 0) ? p : NULL;
+    case ALIGN_ALLOC:
+        return aligned_alloc(a->size, size);
+    default:
+        return memalign(a->size, size);
+    }
+}
+
 /*
  * eval_mm_valid - Check the mm malloc package for correctness
  */
 static int eval_mm_valid(trace_t *trace, range_t **ranges)
 {
+    const traceop_t *a;
     int i;
     int index;
     size_t size;
@@ -910,23 +1665,37 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
             mm_checkheap(verbose);
 
             /* Now check that all our allocated blocks have the right data */
-            r = *ranges;
+            r = *ranges ? (*ranges)->next[0] : NULL;
             while(r) {
                 check_index(trace, i, r->index);
-                r = r->next;
+                r = r->next[0];
             }
         }
 
         switch (trace->ops[i].type) {
 
-        case ALLOC: /* mm_malloc */
+        case ALLOC: /* mm_malloc, or mm_memalign and friends */
+        case CALLOC: /* mm_calloc */
 
             /* Call the student's malloc */
-            if ((p = mm_malloc(size)) == NULL) {
+            if ((a = aligned_by(trace, i)) != NULL)
+                p = mm_aligned(a, size);
+            else if (trace->ops[i].type == CALLOC)
+                p = mm_calloc(1, size);
+            else
+                p = mm_malloc(size);
+            if (p == NULL) {
                 malloc_error(trace, i, "mm_malloc failed.");
                 return 0;
             }
 
+            /* An aligned block must honour the alignment asked for */
+            if (a != NULL && (size_t)p % a->size != 0) {
+                malloc_error(trace, i, "Payload address (%p) not aligned "
+                             "to %u bytes", p, a->size);
+                return 0;
+            }
+
             /*
              * Test the range of the new block for correctness and add it
              * to the range list if OK. The block must be  be aligned properly,
@@ -935,6 +1704,12 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
             if (add_range(ranges, p, size, trace, i, index) == 0)
                 return 0;
 
+            /* A calloc'd block must read as zeros */
+            if (trace->ops[i].type == CALLOC && !is_zero(p, size)) {
+                malloc_error(trace, i, "mm_calloc block is not zeroed.");
+                return 0;
+            }
+
             /* Remember region */
             trace->blocks[index] = p;
             trace->block_sizes[index] = size;
@@ -984,6 +1759,7 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
             break;
 
         case FREE: /* mm_free */
+        case FREE_SIZED: /* mm_free_sized */
             check_index(trace, i, index);
 
             /* Remove region from list and call student's free function */
@@ -993,7 +1769,21 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
                 p = trace->blocks[index];
                 remove_range(ranges, p);
             }
-            mm_free(p);
+            if (trace->ops[i].type == FREE_SIZED)
+                mm_free_sized(p, size);
+            else
+                mm_free(p);
+            break;
+
+        case BATCH: /* mm_malloc_batch or mm_free_batch */
+            if (unbatch)
+                break;
+            if (valid_batch(trace, i, ranges) == 0)
+                return 0;
+            i += size;
+            break;
+
+        case ALIGNED: /* The allocation after it makes the call */
             break;
 
         default:
@@ -1006,25 +1796,74 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
     return 1;
 }
 
+/*
+ * valid_batch - Replay the batch that starts at request i with a single
+ *     mm_malloc_batch or mm_free_batch call, checking its blocks as
+ *     eval_mm_valid checks single requests. Returns 0 on an error.
+ */
+static int valid_batch(trace_t *trace, int i, range_t **ranges)
+{
+    traceop_t *ops = &trace->ops[i + 1];
+    char **batch = trace->batch;
+    int n = trace->ops[i].size;
+    int k, index;
+
+    if (ops[0].type == ALLOC) {
+        if (mm_malloc_batch(ops[0].size, n, (void **)batch) != (size_t)n) {
+            malloc_error(trace, i, "mm_malloc_batch failed.");
+            return 0;
+        }
+        for (k = 0; k < n; k++) {
+            index = ops[k].index;
+            if (add_range(ranges, batch[k], ops[k].size, trace,
+                          i + 1 + k, index) == 0)
+                return 0;
+            trace->blocks[index] = batch[k];
+            trace->block_sizes[index] = ops[k].size;
+            randomize_block(trace, index);
+        }
+    } else {
+        for (k = 0; k < n; k++) {
+            index = ops[k].index;
+            check_index(trace, i + 1 + k, index);
+            if (index < 0) {
+                batch[k] = NULL;
+            } else {
+                batch[k] = trace->blocks[index];
+                remove_range(ranges, batch[k]);
+            }
+        }
+        mm_free_batch((void **)batch, n);
+    }
+    return 1;
+}
+
 /*
  * eval_mm_util - Evaluate the space utilization of the student's package
  *   The idea is to remember the high water mark "hwm" of the heap for
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the
- *   size of the heap in bytes after running the student's malloc
- *   package on the trace. Note that our implementation of mem_sbrk()
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
+ *   largest size of the heap plus the mappings from mem_map in bytes
+ *   while running the student's malloc package on the trace.
+ *   mem_sbrk() lets the students decrement the brk pointer, so the
+ *   peak and final heap sizes are both reported back. With -M, mm_trim
+ *   runs every trim_interval requests, and the bytes one call released
+ *   on average are reported back too. Pages still released from the
+ *   call before count again, so the sum would mean little.
  *
  *   A higher number is better: 1 is optimal.
  */
-static double eval_mm_util(trace_t *trace, int tracenum)
+static double eval_mm_util(trace_t *trace, int tracenum, size_t *peak_heap,
+                           size_t *final_heap, size_t *sbrks, size_t *trimmed)
 {
-    int i;
+    const traceop_t *a;
+    int i, k, n;
     int index;
     int size, newsize, oldsize;
     int max_total_size = 0;
     int total_size = 0;
+    int trims = 0;
+    size_t released = 0;
     char *p;
     char *newp, *oldp;
 
@@ -1035,14 +1874,24 @@ static double eval_mm_util(trace_t *trace, int tracenum)
     if (mm_init() < 0)
         app_error("trace %d: mm_init failed in eval_mm_util", tracenum);
 
+    if (frag_fd >= 0)
+        write_frag_row(trace, 0, 0);
+
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
 
-        case ALLOC: /* mm_alloc */
+        case ALLOC: /* mm_alloc, or mm_memalign and friends */
+        case CALLOC: /* mm_calloc */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
 
-            if ((p = mm_malloc(size)) == NULL) {
+            if ((a = aligned_by(trace, i)) != NULL)
+                p = mm_aligned(a, size);
+            else if (trace->ops[i].type == CALLOC)
+                p = mm_calloc(1, size);
+            else
+                p = mm_malloc(size);
+            if (p == NULL) {
                 app_error("trace %d: mm_malloc failed in eval_mm_util",
                           tracenum);
             }
@@ -1087,6 +1936,31 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             total_size -= size;
             break;
 
+        case FREE_SIZED: /* mm_free_sized */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            mm_free_sized(trace->blocks[index], size);
+            total_size -= size;
+            break;
+
+        case ALIGNED: /* The allocation after it makes the call */
+            break;
+
+        case BATCH: /* mm_malloc_batch or mm_free_batch */
+            if (unbatch)
+                break;
+            n = trace->ops[i].size;
+            for (k = i + 1; k <= i + n; k++) {
+                index = trace->ops[k].index;
+                if (trace->ops[k].type == ALLOC)
+                    total_size += trace->ops[k].size;
+                else if (index >= 0)
+                    total_size -= trace->block_sizes[index];
+            }
+            replay_batch(trace, i);
+            i += n;
+            break;
+
         default:
             app_error("trace %d: Nonexistent request type in eval_mm_util",
                       tracenum);
@@ -1095,11 +1969,66 @@ static double eval_mm_util(trace_t *trace, int tracenum)
         /* update the high-water mark */
         max_total_size = (total_size > max_total_size) ?
             total_size : max_total_size;
+
+        if (trim_interval > 0 && (i + 1) % trim_interval == 0) {
+            released += mm_trim(0);
+            trims++;
+        }
+
+        if (frag_fd >= 0 && ((i + 1) % frag_interval == 0 ||
+                             i + 1 == trace->num_ops))
+            write_frag_row(trace, i + 1, total_size);
     }
 
     printf(".");
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    *peak_heap = mem_peak_heapsize();
+    *final_heap = mem_heapsize() + mem_mapsize();
+    *sbrks = mem_sbrk_calls();
+    *trimmed = trims > 0 ? released / trims : 0;
+    return ((double)max_total_size / (double)*peak_heap);
+}
+
+
+/*
+ * write_frag_header - Start the -F file with the names of the columns
+ */
+static void write_frag_header(void)
+{
+    char buf[MAXLINE];
+    int len, b;
+
+    len = snprintf(buf, sizeof(buf), "trace,op,live_bytes,heap_bytes,util");
+    for (b = 0; b < MM_CLASSES; b++)
+        len += snprintf(buf + len, sizeof(buf) - len, ",free%d", b);
+    len += snprintf(buf + len, sizeof(buf) - len, ",slab_free,largest_free\n");
+    if (write(frag_fd, buf, len) != len)
+        unix_error("write failed in write_frag_header");
+}
+
+/*
+ * write_frag_row - Append one sample of the heap to the -F file: the live
+ *   payload bytes after op requests, the heap size, and the free bytes in
+ *   each seg list. The row goes out in one write to the O_APPEND file, so
+ *   rows from -j workers interleave whole.
+ */
+static void write_frag_row(trace_t *trace, int op, int live)
+{
+    mm_heap_info_t info;
+    char buf[MAXLINE];
+    int len, b;
+
+    mm_heap_info(&info);
+    len = snprintf(buf, sizeof(buf), "%s,%d,%d,%zu,%.4f", trace->filename,
+                   op, live, info.heap_bytes,
+                   info.heap_bytes ? (double)live / info.heap_bytes : 0.0);
+    for (b = 0; b < MM_CLASSES; b++)
+        len += snprintf(buf + len, sizeof(buf) - len, ",%zu",
+                        info.free_bytes[b]);
+    len += snprintf(buf + len, sizeof(buf) - len, ",%zu,%zu\n",
+                    info.slab_free_bytes, info.largest_free);
+    if (write(frag_fd, buf, len) != len)
+        unix_error("write failed in write_frag_row");
 }
 
 
@@ -1131,6 +2060,14 @@ static void eval_mm_speed(void *ptr)
             trace->blocks[index] = p;
             break;
 
+        case CALLOC: /* mm_calloc */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = mm_calloc(1, size)) == NULL)
+                app_error("mm_calloc error in eval_mm_speed");
+            trace->blocks[index] = p;
+            break;
+
         case REALLOC: /* mm_realloc */
             index = trace->ops[i].index;
             newsize = trace->ops[i].size;
@@ -1150,11 +2087,401 @@ static void eval_mm_speed(void *ptr)
             mm_free(block);
             break;
 
+        case FREE_SIZED: /* mm_free_sized */
+            index = trace->ops[i].index;
+            mm_free_sized(trace->blocks[index], trace->ops[i].size);
+            break;
+
+        case ALIGNED: /* mm_memalign and friends, for the next request */
+            index = trace->ops[i + 1].index;
+            size = trace->ops[i + 1].size;
+            if ((p = mm_aligned(&trace->ops[i], size)) == NULL)
+                app_error("mm_memalign error in eval_mm_speed");
+            trace->blocks[index] = p;
+            i++;
+            break;
+
+        case BATCH: /* mm_malloc_batch or mm_free_batch */
+            if (unbatch)
+                break;
+            replay_batch(trace, i);
+            i += trace->ops[i].size;
+            break;
+
         default:
             app_error("Nonexistent request type in eval_mm_speed");
         }
 }
 
+/*
+ * replay_batch - Replay the batch that starts at request i with a single
+ *     mm_malloc_batch or mm_free_batch call
+ */
+static void replay_batch(trace_t *trace, int i)
+{
+    traceop_t *ops = &trace->ops[i + 1];
+    int n = trace->ops[i].size;
+    int k;
+
+    if (ops[0].type == ALLOC) {
+        if (mm_malloc_batch(ops[0].size, n, (void **)trace->batch) != (size_t)n)
+            app_error("mm_malloc_batch error in replay_batch");
+        for (k = 0; k < n; k++) {
+            trace->blocks[ops[k].index] = trace->batch[k];
+            trace->block_sizes[ops[k].index] = ops[k].size;
+        }
+    } else {
+        for (k = 0; k < n; k++)
+            trace->batch[k] = (ops[k].index < 0) ? NULL :
+                trace->blocks[ops[k].index];
+        mm_free_batch((void **)trace->batch, n);
+    }
+}
+
+/*
+ * read_tsc - Read the cycle counter, or a ns clock where there is none
+ */
+static inline uint64_t read_tsc(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/*
+ * lat_bucket - Histogram bucket of a latency of v ticks. Values below
+ *     2^LAT_SUB_BITS get a bucket each, larger ones share a bucket with
+ *     the values that agree in their top LAT_SUB_BITS+1 bits.
+ */
+static inline int lat_bucket(uint64_t v)
+{
+    int e;
+
+    if (v < (1 << LAT_SUB_BITS))
+        return v;
+    e = 63 - __builtin_clzll(v);
+    return ((e - LAT_SUB_BITS + 1) << LAT_SUB_BITS) +
+        ((v >> (e - LAT_SUB_BITS)) & ((1 << LAT_SUB_BITS) - 1));
+}
+
+/*
+ * lat_bucket_max - Largest latency that falls in bucket b
+ */
+static uint64_t lat_bucket_max(int b)
+{
+    int e = (b >> LAT_SUB_BITS) + LAT_SUB_BITS - 1;
+    uint64_t sub = b & ((1 << LAT_SUB_BITS) - 1);
+
+    if (b < (1 << LAT_SUB_BITS))
+        return b;
+    return ((((uint64_t)1 << LAT_SUB_BITS) + sub + 1) << (e - LAT_SUB_BITS)) - 1;
+}
+
+/*
+ * lat_percentile - Latency in ns that a fraction p of the n requests
+ *     in hist do not exceed, given that none exceeds max ticks
+ */
+static double lat_percentile(const unsigned long *hist, unsigned long n,
+                             double p, uint64_t max, double ticks_per_ns)
+{
+    unsigned long seen = 0;
+    unsigned long want = (unsigned long)(p * n + 0.5);
+    int b;
+
+    if (want == 0)
+        want = 1;
+    for (b = 0; b < LAT_BUCKETS; b++) {
+        seen += hist[b];
+        if (seen >= want)
+            break;
+    }
+    if (lat_bucket_max(b) < max)
+        max = lat_bucket_max(b);
+    return max / ticks_per_ns;
+}
+
+/*
+ * eval_mm_latency - Replay the trace once more, timing every request on
+ *     its own, and store the percentiles for each request type in lat
+ */
+static void eval_mm_latency(trace_t *trace, lat_t *lat)
+{
+    static double ticks_per_ns = 0;
+    static uint64_t overhead = ~(uint64_t)0;
+    unsigned long (*hist)[LAT_BUCKETS];
+    uint64_t max[LAT_TYPES] = {0};
+    uint64_t t0, t1, ticks;
+    int i, t, type, index;
+    char *p;
+
+    /* Ticks per ns, and the cost of reading the counter twice */
+    if (ticks_per_ns == 0) {
+#if defined(__x86_64__) || defined(__i386__)
+        ticks_per_ns = mhz(0) / 1e3;
+#else
+        ticks_per_ns = 1;
+#endif
+        for (i = 0; i < 1000; i++) {
+            t0 = read_tsc();
+            t1 = read_tsc();
+            if (t1 - t0 < overhead)
+                overhead = t1 - t0;
+        }
+    }
+
+    if ((hist = calloc(LAT_TYPES, sizeof(*hist))) == NULL)
+        unix_error("calloc failed in eval_mm_latency");
+
+    reinit_trace(trace);
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed in eval_mm_latency");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        type = trace->ops[i].type;
+        index = trace->ops[i].index;
+
+        switch (type) {
+        case ALLOC:
+            t0 = read_tsc();
+            p = mm_malloc(trace->ops[i].size);
+            t1 = read_tsc();
+            if (p == NULL)
+                app_error("mm_malloc error in eval_mm_latency");
+            trace->blocks[index] = p;
+            break;
+
+        case CALLOC:
+            t0 = read_tsc();
+            p = mm_calloc(1, trace->ops[i].size);
+            t1 = read_tsc();
+            if (p == NULL)
+                app_error("mm_calloc error in eval_mm_latency");
+            trace->blocks[index] = p;
+            break;
+
+        case REALLOC:
+            t0 = read_tsc();
+            p = mm_realloc(trace->blocks[index], trace->ops[i].size);
+            t1 = read_tsc();
+            if (p == NULL && trace->ops[i].size != 0)
+                app_error("mm_realloc error in eval_mm_latency");
+            trace->blocks[index] = p;
+            break;
+
+        case FREE:
+            p = (index < 0) ? NULL : trace->blocks[index];
+            t0 = read_tsc();
+            mm_free(p);
+            t1 = read_tsc();
+            break;
+
+        case FREE_SIZED:
+            p = trace->blocks[index];
+            t0 = read_tsc();
+            mm_free_sized(p, trace->ops[i].size);
+            t1 = read_tsc();
+            break;
+
+        case ALIGNED: /* Timed with the allocation after it */
+            index = trace->ops[i + 1].index;
+            t0 = read_tsc();
+            p = mm_aligned(&trace->ops[i], trace->ops[i + 1].size);
+            t1 = read_tsc();
+            if (p == NULL)
+                app_error("mm_memalign error in eval_mm_latency");
+            trace->blocks[index] = p;
+            i++;
+            break;
+
+        case BATCH: /* Its requests are timed one by one */
+            continue;
+
+        default:
+            app_error("Nonexistent request type in eval_mm_latency");
+        }
+
+        ticks = (t1 - t0 > overhead) ? t1 - t0 - overhead : 0;
+        hist[type][lat_bucket(ticks)]++;
+        if (ticks > max[type])
+            max[type] = ticks;
+    }
+
+    for (t = 0; t < LAT_TYPES; t++) {
+        lat[t].n = 0;
+        for (i = 0; i < LAT_BUCKETS; i++)
+            lat[t].n += hist[t][i];
+        if (lat[t].n == 0)
+            continue;
+        lat[t].p50 = lat_percentile(hist[t], lat[t].n, 0.5, max[t],
+                                    ticks_per_ns);
+        lat[t].p99 = lat_percentile(hist[t], lat[t].n, 0.99, max[t],
+                                    ticks_per_ns);
+        lat[t].p999 = lat_percentile(hist[t], lat[t].n, 0.999, max[t],
+                                    ticks_per_ns);
+        lat[t].max = max[t] / ticks_per_ns;
+    }
+    free(hist);
+}
+
+/*
+ * eval_mm_mt - Replay the trace on nthreads threads sharing one mm heap.
+ *    Returns 0 if the package ran out of memory. *secs is the best wall
+ *    time over MT_REPS runs, and thread_secs[] holds the time each thread
+ *    spent in that run.
+ */
+static int eval_mm_mt(trace_t *trace, int nthreads, double *secs,
+                      double *thread_secs)
+{
+    int i, t, rep, index;
+    int *count;
+    double start, elapsed;
+    mt_replay_t replay;
+    mt_worker_t *workers;
+    size_t nblocks = (size_t)nthreads * trace->num_ids;
+
+    replay.trace = trace;
+    replay.nthreads = nthreads;
+    if ((replay.blocks = calloc(nblocks, sizeof(char *))) == NULL ||
+        (replay.done = calloc(nblocks, sizeof(int))) == NULL ||
+        (replay.seq = calloc(trace->num_ops, sizeof(int))) == NULL ||
+        (count = calloc(trace->num_ids, sizeof(int))) == NULL ||
+        (workers = calloc(nthreads, sizeof(mt_worker_t))) == NULL)
+        unix_error("calloc failed in eval_mm_mt");
+
+    /* Number each request among the requests on the same block */
+    for (i = 0; i < trace->num_ops; i++) {
+        index = trace->ops[i].index;
+        if (index >= 0 && trace->ops[i].type != BATCH &&
+            trace->ops[i].type != ALIGNED)
+            replay.seq[i] = count[index]++;
+    }
+    free(count);
+
+    *secs = DBL_MAX;
+    for (rep = 0; rep < MT_REPS; rep++) {
+        memset(replay.blocks, 0, nblocks * sizeof(char *));
+        memset(replay.done, 0, nblocks * sizeof(int));
+        replay.failed = 0;
+
+        mem_reset_brk();
+        if (mm_init() < 0)
+            app_error("mm_init failed in eval_mm_mt");
+
+        pthread_barrier_init(&replay.start, NULL, nthreads + 1);
+        for (t = 0; t < nthreads; t++) {
+            workers[t].replay = &replay;
+            workers[t].tid = t;
+            if (pthread_create(&workers[t].thread, NULL,
+                               eval_mm_mt_thread, &workers[t]) != 0)
+                unix_error("pthread_create failed in eval_mm_mt");
+        }
+        start = wall_secs();
+        pthread_barrier_wait(&replay.start);
+        for (t = 0; t < nthreads; t++)
+            pthread_join(workers[t].thread, NULL);
+        elapsed = wall_secs() - start;
+        pthread_barrier_destroy(&replay.start);
+
+        if (replay.failed)
+            break;
+        if (elapsed < *secs) {
+            *secs = elapsed;
+            for (t = 0; t < nthreads; t++)
+                thread_secs[t] = workers[t].secs;
+        }
+    }
+
+    free(replay.blocks);
+    free(replay.done);
+    free(replay.seq);
+    free(workers);
+    return !replay.failed;
+}
+
+/*
+ * eval_mm_mt_thread - Body of one replay thread. Frees of odd ids are
+ *    applied to the previous thread's copy of the block, so a block is
+ *    often freed by a different thread than the one that allocated it.
+ */
+static void *eval_mm_mt_thread(void *ptr)
+{
+    mt_worker_t *self = ptr;
+    mt_replay_t *replay = self->replay;
+    trace_t *trace = replay->trace;
+    const traceop_t *a;
+    int i, index, owner;
+    int *done;
+    char **block;
+    double start;
+
+    pthread_barrier_wait(&replay->start);
+    start = wall_secs();
+
+    for (i = 0; i < trace->num_ops && !replay->failed; i++) {
+        index = trace->ops[i].index;
+        if (trace->ops[i].type == BATCH || trace->ops[i].type == ALIGNED)
+            continue;
+        if (index < 0) {
+            mm_free(NULL);
+            continue;
+        }
+
+        owner = self->tid;
+        if ((trace->ops[i].type == FREE ||
+             trace->ops[i].type == FREE_SIZED) && MT_XFREE(index))
+            owner = (owner + replay->nthreads - 1) % replay->nthreads;
+        block = &replay->blocks[(size_t)owner * trace->num_ids + index];
+        done = &replay->done[(size_t)owner * trace->num_ids + index];
+
+        /* Wait for the previous request on this block, if another
+           thread owns it */
+        while (__atomic_load_n(done, __ATOMIC_ACQUIRE) != replay->seq[i]) {
+            if (replay->failed)
+                goto out;
+            sched_yield();
+        }
+
+        switch (trace->ops[i].type) {
+        case ALLOC:
+            if ((a = aligned_by(trace, i)) != NULL)
+                *block = mm_aligned(a, trace->ops[i].size);
+            else
+                *block = mm_malloc(trace->ops[i].size);
+            if (*block == NULL)
+                replay->failed = 1;
+            break;
+        case CALLOC:
+            if ((*block = mm_calloc(1, trace->ops[i].size)) == NULL)
+                replay->failed = 1;
+            break;
+        case REALLOC:
+            *block = mm_realloc(*block, trace->ops[i].size);
+            if (*block == NULL && trace->ops[i].size != 0)
+                replay->failed = 1;
+            break;
+        case FREE:
+            mm_free(*block);
+            break;
+        case FREE_SIZED:
+            mm_free_sized(*block, trace->ops[i].size);
+            break;
+        default:
+            app_error("Nonexistent request type in eval_mm_mt_thread");
+        }
+        __atomic_store_n(done, replay->seq[i] + 1, __ATOMIC_RELEASE);
+    }
+
+ out:
+    self->secs = wall_secs() - start;
+    return NULL;
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -1163,6 +2490,7 @@ static void eval_mm_speed(void *ptr)
  */
 static int eval_libc_valid(trace_t *trace)
 {
+    const traceop_t *a;
     int i, newsize;
     char *p, *newp, *oldp;
 
@@ -1171,14 +2499,26 @@ static int eval_libc_valid(trace_t *trace)
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
 
-        case ALLOC: /* malloc */
-            if ((p = malloc(trace->ops[i].size)) == NULL) {
+        case ALLOC: /* malloc, or memalign and friends */
+            if ((a = aligned_by(trace, i)) != NULL)
+                p = libc_aligned(a, trace->ops[i].size);
+            else
+                p = malloc(trace->ops[i].size);
+            if (p == NULL) {
                 malloc_error(trace, i, "libc malloc failed");
                 unix_error("System message");
             }
             trace->blocks[trace->ops[i].index] = p;
             break;
 
+        case CALLOC: /* calloc */
+            if ((p = calloc(1, trace->ops[i].size)) == NULL) {
+                malloc_error(trace, i, "libc calloc failed");
+                unix_error("System message");
+            }
+            trace->blocks[trace->ops[i].index] = p;
+            break;
+
         case REALLOC: /* realloc */
             newsize = trace->ops[i].size;
             oldp = trace->blocks[trace->ops[i].index];
@@ -1190,6 +2530,7 @@ static int eval_libc_valid(trace_t *trace)
             break;
 
         case FREE: /* free */
+        case FREE_SIZED: /* glibc has no free_sized yet */
             if(trace->ops[i].index >= 0) {
                 free(trace->blocks[trace->ops[i].index]);
             } else {
@@ -1197,6 +2538,10 @@ static int eval_libc_valid(trace_t *trace)
             }
             break;
 
+        case BATCH: /* libc has no batch calls */
+        case ALIGNED: /* The allocation after it makes the call */
+            break;
+
         default:
             app_error("invalid operation type  in eval_libc_valid");
         }
@@ -1212,6 +2557,7 @@ static int eval_libc_valid(trace_t *trace)
  */
 static void eval_libc_speed(void *ptr)
 {
+    const traceop_t *a;
     int i;
     int index, size, newsize;
     char *p, *newp, *oldp, *block;
@@ -1221,14 +2567,26 @@ static void eval_libc_speed(void *ptr)
 
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
-        case ALLOC: /* malloc */
+        case ALLOC: /* malloc, or memalign and friends */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
-            if ((p = malloc(size)) == NULL)
+            if ((a = aligned_by(trace, i)) != NULL)
+                p = libc_aligned(a, size);
+            else
+                p = malloc(size);
+            if (p == NULL)
                 unix_error("malloc failed in eval_libc_speed");
             trace->blocks[index] = p;
             break;
 
+        case CALLOC: /* calloc */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = calloc(1, size)) == NULL)
+                unix_error("calloc failed in eval_libc_speed");
+            trace->blocks[index] = p;
+            break;
+
         case REALLOC: /* realloc */
             index = trace->ops[i].index;
             newsize = trace->ops[i].size;
@@ -1240,6 +2598,7 @@ static void eval_libc_speed(void *ptr)
             break;
 
         case FREE: /* free */
+        case FREE_SIZED: /* glibc has no free_sized yet */
             index = trace->ops[i].index;
             if(index >= 0) {
                 block = trace->blocks[index];
@@ -1275,8 +2634,14 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
     char wstr;
 
     /* Print the individual results for each trace */
-    printf("  %2s%6s %5s%8s%9s  %s\n",
-           "valid", "util", "ops", "secs", "Kops", "trace");
+    printf("  %2s%6s %5s%8s%9s", "valid", "util", "ops", "secs", "Kops");
+    if (hw_flag)
+        printf("%7s%6s%7s%8s%8s%7s", "cyc/op", "IPC", "L1m/op", "LLCm/op",
+               "TLBm/op", "brm/op");
+    printf("%8s%8s%7s", "peakKB", "finKB", "sbrk");
+    if (trim_interval > 0)
+        printf("%8s", "trimKB");
+    printf("  %s\n", "trace");
     for (i=0; i < n; i++) {
         if (stats[i].valid) {
             switch(stats[i].weight)
@@ -1318,6 +2683,21 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
             else
                 printf("%8s%10s%6s", "--", "--", "--");
 
+            /* hardware events per request of one replay */
+            if (hw_flag)
+                print_hw(&stats[i]);
+
+            /* print '--' for heap sizes libc does not report */
+            if(stats[i].peak_heap != 0)
+                printf("%8zu%8zu%7zu", stats[i].peak_heap / 1024,
+                       stats[i].final_heap / 1024, stats[i].sbrks);
+            else
+                printf("%8s%8s%7s", "--", "--", "--");
+            if (trim_interval > 0 && stats[i].peak_heap != 0)
+                printf("%8zu", stats[i].trimmed / 1024);
+            else if (trim_interval > 0)
+                printf("%8s", "--");
+
             printf(" %s\n", stats[i].filename);
 
             if(stats[i].weight == WALL || stats[i].weight == WPERF)
@@ -1333,14 +2713,19 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
                 }
         }
         else {
-            printf("%2s%4s %6s%8s%10s%6s %s\n",
+            printf("%2s%4s %6s%8s%10s%6s",
                    stats[i].weight != 0 ? "*" : "",
                    "no",
                    "-",
                    "-",
                    "-",
-                   "-",
-                   stats[i].filename);
+                   "-");
+            if (hw_flag)
+                printf("%7s%6s%7s%8s%8s%7s", "-", "-", "-", "-", "-", "-");
+            printf("%8s%8s%7s", "-", "-", "-");
+            if (trim_interval > 0)
+                printf("%8s", "-");
+            printf(" %s\n", stats[i].filename);
         }
     }
 
@@ -1383,6 +2768,17 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
     }
 }
 
+/*
+ * wall_secs - Monotonic wall clock time in seconds
+ */
+static double wall_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
 /*
  * app_error - Report an arbitrary application error
  */
@@ -1423,6 +2819,123 @@ void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
     va_end(ap);
 }
 
+#ifdef MM_STATS
+/*
+ * print_alloc_stats - Print the allocator counters gathered during the
+ *     util run of each valid trace
+ */
+static void print_alloc_stats(int n, stats_t *stats)
+{
+    int i, b;
+    const mm_stats_t *st;
+
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        st = &stats[i].alloc;
+        printf("Allocator stats for %s:\n", stats[i].filename);
+
+        /* Bucket b holds 2^(b-1) to 2^b - 1 blocks visited */
+        printf("  fit probes:");
+        for (b = 0; b < MM_STATS_PROBES; b++) {
+            if (st->probes[b] == 0)
+                continue;
+            if (b <= 1)
+                printf(" %d:%lu", b, st->probes[b]);
+            else if (b == MM_STATS_PROBES - 1)
+                printf(" %d+:%lu", 1 << (b - 1), st->probes[b]);
+            else
+                printf(" %d-%d:%lu", 1 << (b - 1), (1 << b) - 1,
+                       st->probes[b]);
+        }
+        printf("\n");
+
+        printf("  %5s%10s%10s%10s\n", "class", "hits", "spills", "misses");
+        for (b = 0; b < MM_CLASSES; b++) {
+            if (st->class_hits[b] + st->class_spills[b] +
+                st->class_misses[b] == 0)
+                continue;
+            printf("  %5d%10lu%10lu%10lu\n", b, st->class_hits[b],
+                   st->class_spills[b], st->class_misses[b]);
+        }
+
+        printf("  coalesce cases: 1:%lu 2:%lu 3:%lu 4:%lu\n",
+               st->coalesce[0], st->coalesce[1], st->coalesce[2],
+               st->coalesce[3]);
+        printf("  extend_heap: %lu calls, %lu KB\n",
+               st->extend_calls, st->extend_bytes / 1024);
+        printf("  realloc copies: %lu, %lu KB\n",
+               st->realloc_copies, st->realloc_copy_bytes / 1024);
+        printf("  calloc: %lu calls, %lu KB, %lu KB cleared\n\n",
+               st->calloc_calls, st->calloc_bytes / 1024,
+               st->calloc_cleared / 1024);
+    }
+}
+#endif
+
+/*
+ * print_hw - Print the hardware counters of one trace per request, '--'
+ *     for the events that could not be counted
+ */
+static void print_hw(const stats_t *stats)
+{
+    const double *c = stats->hw.count;
+    double ops = stats->ops;
+
+    if (c[PERFCTR_CYCLES] >= 0)
+        printf("%7.0f", c[PERFCTR_CYCLES] / ops);
+    else
+        printf("%7s", "--");
+    if (c[PERFCTR_CYCLES] > 0 && c[PERFCTR_INSTRUCTIONS] >= 0)
+        printf("%6.2f", c[PERFCTR_INSTRUCTIONS] / c[PERFCTR_CYCLES]);
+    else
+        printf("%6s", "--");
+    if (c[PERFCTR_L1D_MISSES] >= 0)
+        printf("%7.2f", c[PERFCTR_L1D_MISSES] / ops);
+    else
+        printf("%7s", "--");
+    if (c[PERFCTR_LLC_MISSES] >= 0)
+        printf("%8.3f", c[PERFCTR_LLC_MISSES] / ops);
+    else
+        printf("%8s", "--");
+    if (c[PERFCTR_DTLB_MISSES] >= 0)
+        printf("%8.3f", c[PERFCTR_DTLB_MISSES] / ops);
+    else
+        printf("%8s", "--");
+    if (c[PERFCTR_BRANCH_MISSES] >= 0)
+        printf("%7.3f", c[PERFCTR_BRANCH_MISSES] / ops);
+    else
+        printf("%7s", "--");
+}
+
+/*
+ * print_latency - Print the latency percentiles of each request type
+ *     for each valid trace
+ */
+static void print_latency(int n, stats_t *stats)
+{
+    static const char *names[LAT_TYPES] = { "malloc", "free", "realloc", "calloc",
+                                            "batch", "memalign", "free_sz" };
+    int i, t;
+
+    printf("Latency in ns:\n");
+    printf("%8s%9s%9s%9s%9s%11s  %s\n",
+           "op", "n", "p50", "p99", "p99.9", "max", "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        for (t = 0; t < LAT_TYPES; t++) {
+            if (stats[i].lat[t].n == 0)
+                continue;
+            printf("%8s%9lu%9.0f%9.0f%9.0f%11.0f  %s\n", names[t],
+                   stats[i].lat[t].n, stats[i].lat[t].p50,
+                   stats[i].lat[t].p99, stats[i].lat[t].p999,
+                   stats[i].lat[t].max, stats[i].filename);
+        }
+    }
+    printf("\n");
+}
+
 /*
  * usage - Explain the command line arguments
  */
@@ -1441,4 +2954,18 @@ static void usage(void)
     fprintf(stderr, "\t-v <i>     Set Verbosity Level to <i>\n");
     fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-B <mode>  Back the heap with devzero, noreserve, thp or hugetlb.\n");
+    fprintf(stderr, "\t-R         Release the heap pages whenever the heap is reset.\n");
+    fprintf(stderr, "\t-U         Replay batched requests one at a time.\n");
+    fprintf(stderr, "\t-m <n>     Give requests of at least n bytes their own mapping.\n");
+    fprintf(stderr, "\t-j <n>     Evaluate traces in n worker processes (0: one per CPU).\n");
+    fprintf(stderr, "\t-C <cpus>  Pin the timing runs to these CPUs, e.g. 2,3,6-9.\n");
+    fprintf(stderr, "\t-T <n>     Replay traces on n threads (mdriver-ts only).\n");
+    fprintf(stderr, "\t-H         Count hardware events (cycles, misses) per request.\n");
+    fprintf(stderr, "\t-L         Print per-request latency percentiles.\n");
+    fprintf(stderr, "\t-F <file>  Write a fragmentation timeline of each trace as CSV.\n");
+    fprintf(stderr, "\t-k <n>     Sample the -F timeline every n requests (default 1000).\n");
+    fprintf(stderr, "\t-M <n>     Call mm_trim every n requests, print the KB a call released.\n");
+    fprintf(stderr, "\t-S         Print allocator counters (use mdriver-stats).\n");
+    fprintf(stderr, "\t-w <file>  Write the -f trace to <file> in binary format.\n");
 }
@@ -0,0 +1,411 @@
+/*
+ * memlib-os.c - the memory system of a real process, for libmm.so, the
+ *						LD_PRELOAD build of mm.c. It has the interface of
+ *						memlib.c, but the heap is an OS_MAX_HEAP region reserved
+ *						up front that the kernel commits page by page as it
+ *						is touched, and mem_map hands out real mappings.
+ *
+ *						mm.c is the malloc of the process, so nothing here
+ *						may call malloc or stdio. Like memlib.c it is not
+ *						thread-safe: mm.c only calls it under heap_lock.
+ */
+#define _GNU_SOURCE					/* for mremap */
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <errno.h>
+
+#include "memlib.h"
+#include "config.h"
+
+#define MIN_MAPS	256				/* Slots in the first mapping table */
+
+/* private variables */
+static char *heap;					/* NULL until the first mem_sbrk */
+static char *mem_brk;
+static char *mem_max_addr;
+static size_t mem_peak;				/* largest heap plus mapped size since
+									   the last reset */
+static size_t sbrk_calls;			/* mem_sbrk calls since the last reset */
+static char *mem_zero;				/* the heap is all zeros from here on */
+
+/*
+ * Mappings handed out by mem_map, in an open addressing table keyed by
+ * start address. A slot with a NULL addr is empty. The table itself is a
+ * mapping, since it cannot come from malloc.
+ */
+typedef struct {
+	char *addr;
+	size_t len;
+} mapping_t;
+
+static mapping_t *maps;
+static size_t num_maps;
+static size_t max_maps;				/* slots in maps, a power of two */
+static size_t mapped_bytes;			/* total length of all the mappings */
+
+static mapping_t *find_slot(const void *addr);
+static int add_map(char *addr, size_t len);
+static void delete_map(mapping_t *m);
+static void update_peak(void);
+static void release_from(char *lo);
+static void os_error(const char *msg);
+
+/*
+ * mem_init - reserve the address space of the heap. Pages are only
+ *		committed when the heap grows over them.
+ */
+void mem_init(void){
+	heap = mmap(NULL, OS_MAX_HEAP, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (heap == MAP_FAILED) {
+		heap = NULL;
+		os_error("mem_init failed to reserve the heap\n");
+		return;
+	}
+	mem_max_addr = heap + OS_MAX_HEAP;
+	mem_brk = heap;					/* heap is empty initially */
+	mem_zero = heap;
+	mem_peak = 0;
+}
+
+/*
+ * mem_deinit - give the heap, the mappings and the table back
+ */
+void mem_deinit(void){
+	if (heap == NULL)
+		return;
+	mem_reset_brk();
+	munmap(heap, OS_MAX_HEAP);
+	heap = NULL;
+	if (maps != NULL)
+		munmap(maps, max_maps * sizeof(mapping_t));
+	maps = NULL;
+	max_maps = 0;
+}
+
+/*
+ * mem_reset_brk - empty the heap and release its pages, and drop every
+ *		mapping
+ */
+void mem_reset_brk(){
+	size_t i;
+
+	if (heap != NULL) {
+		release_from(heap);
+		mem_brk = heap;
+	}
+	for (i = 0; i < max_maps; i++) {
+		if (maps[i].addr != NULL) {
+			munmap(maps[i].addr, maps[i].len);
+			maps[i].addr = NULL;
+		}
+	}
+	num_maps = 0;
+	mapped_bytes = 0;
+	mem_peak = 0;
+	sbrk_calls = 0;
+}
+
+/*
+ * mem_sbrk - move the end of the heap by incr bytes and return the old
+ *		end. A negative incr shrinks the heap and gives its pages back.
+ */
+void *mem_sbrk(int incr) {
+	char *old_brk;
+
+	if (heap == NULL) {
+		mem_init();
+		if (heap == NULL) {
+			errno = ENOMEM;
+			return (void *)-1;
+		}
+	}
+	old_brk = mem_brk;
+	sbrk_calls++;
+
+	if (incr < 0) {
+		if (mem_brk + incr < heap) {
+			errno = EINVAL;
+			return (void *)-1;
+		}
+		mem_brk += incr;
+		release_from(mem_brk);
+		return (void *)old_brk;
+	}
+
+	if (mem_brk + incr > mem_max_addr) {
+		errno = ENOMEM;
+		return (void *)-1;
+	}
+	mem_brk += incr;
+	if (mem_brk > mem_zero)
+		mem_zero = mem_brk;
+	update_peak();
+	return (void *)old_brk;
+}
+
+/*
+ * mem_map - anonymous mmap of len bytes outside the heap.
+ *		Returns the start of the mapping, or (void *)-1 on failure.
+ */
+void *mem_map(size_t len) {
+	char *addr;
+
+	addr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED)
+		return (void *)-1;
+	if (add_map(addr, len) < 0) {
+		munmap(addr, len);
+		errno = ENOMEM;
+		return (void *)-1;
+	}
+	update_peak();
+	return addr;
+}
+
+/*
+ * mem_unmap - unmap a mapping returned by mem_map or mem_remap.
+ *		Returns 0 on success, -1 if addr does not start a mapping.
+ */
+int mem_unmap(void *addr) {
+	mapping_t *m = find_slot(addr);
+
+	if (m == NULL || m->addr == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	munmap(m->addr, m->len);
+	delete_map(m);
+	return 0;
+}
+
+/*
+ * mem_remap - resize a mapping to newlen bytes with mremap, moving it
+ *		if it cannot grow in place. Returns the new start of the
+ *		mapping, or (void *)-1 on failure with the old one left intact.
+ */
+void *mem_remap(void *addr, size_t newlen) {
+	mapping_t *m = find_slot(addr);
+	char *newaddr;
+
+	if (m == NULL || m->addr == NULL) {
+		errno = EINVAL;
+		return (void *)-1;
+	}
+	newaddr = mremap(m->addr, m->len, newlen, MREMAP_MAYMOVE);
+	if (newaddr == MAP_FAILED)
+		return (void *)-1;
+
+	/* The table never has to grow here: one entry goes, one comes */
+	delete_map(m);
+	add_map(newaddr, newlen);
+	update_peak();
+	return newaddr;
+}
+
+/*
+ * mem_is_mapped - check that [lo, lo+len) lies within a single mapping.
+ *		Only the driver's checks use it, so a scan is good enough.
+ */
+int mem_is_mapped(const void *lo, size_t len) {
+	size_t i;
+
+	for (i = 0; i < max_maps; i++) {
+		if (maps[i].addr != NULL && (const char *)lo >= maps[i].addr &&
+			(const char *)lo + len <= maps[i].addr + maps[i].len)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * map_hash - home slot of the mapping that starts at addr
+ */
+static size_t map_hash(const void *addr) {
+	return (size_t)(((uintptr_t)addr >> 12) * 0x9e3779b97f4a7c15ull) &
+		(max_maps - 1);
+}
+
+/*
+ * find_slot - return the slot of the mapping that starts at addr, or the
+ *		empty slot where it would go. NULL if there is no table yet.
+ */
+static mapping_t *find_slot(const void *addr) {
+	size_t i;
+
+	if (maps == NULL)
+		return NULL;
+	for (i = map_hash(addr); maps[i].addr != NULL; i = (i + 1) & (max_maps - 1)) {
+		if (maps[i].addr == addr)
+			break;
+	}
+	return &maps[i];
+}
+
+/*
+ * add_map - enter a new mapping in the table, doubling it once it is
+ *		half full. Returns 0 on success, -1 if the table cannot grow.
+ */
+static int add_map(char *addr, size_t len) {
+	mapping_t *old = maps;
+	size_t old_max = max_maps;
+	size_t i;
+
+	if (2 * (num_maps + 1) > max_maps) {
+		max_maps = max_maps ? 2 * max_maps : MIN_MAPS;
+		maps = mmap(NULL, max_maps * sizeof(mapping_t), PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (maps == MAP_FAILED) {
+			maps = old;
+			max_maps = old_max;
+			return -1;
+		}
+		for (i = 0; i < old_max; i++) {
+			if (old[i].addr != NULL)
+				*find_slot(old[i].addr) = old[i];
+		}
+		if (old != NULL)
+			munmap(old, old_max * sizeof(mapping_t));
+	}
+	*find_slot(addr) = (mapping_t){addr, len};
+	num_maps++;
+	mapped_bytes += len;
+	return 0;
+}
+
+/*
+ * delete_map - remove the mapping in slot m, moving later entries of its
+ *		probe run back so that no lookup stops early at the hole
+ */
+static void delete_map(mapping_t *m) {
+	size_t mask = max_maps - 1;
+	size_t i = m - maps;
+	size_t j = i;
+	size_t home;
+
+	mapped_bytes -= m->len;
+	num_maps--;
+	for (;;) {
+		j = (j + 1) & mask;
+		if (maps[j].addr == NULL)
+			break;
+		home = map_hash(maps[j].addr);
+		/* Entry j may fill the hole at i if its home is not in (i, j] */
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			maps[i] = maps[j];
+			i = j;
+		}
+	}
+	maps[i].addr = NULL;
+}
+
+/*
+ * update_peak - fold the current footprint into the high-water mark
+ */
+static void update_peak(void) {
+	size_t size = mem_heapsize() + mapped_bytes;
+
+	if (size > mem_peak)
+		mem_peak = size;
+}
+
+/*
+ * os_error - report a failure without stdio, which may call malloc
+ */
+static void os_error(const char *msg) {
+	ssize_t ret = write(STDERR_FILENO, msg, strlen(msg));
+
+	(void)ret;
+}
+
+/*
+ * mem_release - tell the kernel the whole pages inside [addr, addr+len)
+ *		are unused. They stay mapped and read back as zeros.
+ *		Returns the number of bytes released.
+ */
+size_t mem_release(void *addr, size_t len) {
+	size_t pagesize = mem_pagesize();
+	char *lo = (char *)(((size_t)addr + pagesize - 1) & ~(pagesize - 1));
+	char *hi = (char *)(((size_t)addr + len) & ~(pagesize - 1));
+
+	if (hi <= lo || madvise(lo, hi - lo, MADV_DONTNEED) != 0)
+		return 0;
+	return (size_t)(hi - lo);
+}
+
+/*
+ * release_from - give back the pages from lo up to the part of the heap
+ *		that was never written. The heap then reads as zeros from the
+ *		first page boundary at or above lo.
+ */
+static void release_from(char *lo) {
+	size_t pagesize = mem_pagesize();
+	char *lo_page = (char *)(((size_t)lo + pagesize - 1) & ~(pagesize - 1));
+	char *hi = (char *)(((size_t)mem_zero + pagesize - 1) & ~(pagesize - 1));
+
+	if (hi > lo_page && mem_release(lo, hi - lo) == (size_t)(hi - lo_page))
+		mem_zero = lo_page;
+}
+
+/*
+ * mem_zero_lo - return the address from which the heap, up to its end
+ *		and beyond, has not been written since it was last zero
+ */
+void *mem_zero_lo(){
+	return (void *)mem_zero;
+}
+
+/*
+ * mem_heap_lo - return address of the first heap byte
+ */
+void *mem_heap_lo(){
+	return (void *)heap;
+}
+
+/*
+ * mem_heap_hi - return address of last heap byte
+ */
+void *mem_heap_hi(){
+	return (void *)(mem_brk - 1);
+}
+
+/*
+ * mem_heapsize() - returns the heap size in bytes
+ */
+size_t mem_heapsize() {
+	return (size_t)(mem_brk - heap);
+}
+
+/*
+ * mem_mapsize() - returns the total size of the mappings in bytes
+ */
+size_t mem_mapsize() {
+	return mapped_bytes;
+}
+
+/*
+ * mem_peak_heapsize() - returns the largest heap plus mapped size in
+ *		bytes since the last reset
+ */
+size_t mem_peak_heapsize() {
+	return mem_peak;
+}
+
+/*
+ * mem_sbrk_calls() - returns the number of mem_sbrk calls since the
+ *		last reset
+ */
+size_t mem_sbrk_calls() {
+	return sbrk_calls;
+}
+
+/*
+ * mem_pagesize() - returns the page size of the system
+ */
+size_t mem_pagesize(){
+	return (size_t)getpagesize();
+}
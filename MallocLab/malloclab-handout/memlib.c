@@ -2,7 +2,16 @@
  * memlib.c - a module that simulates the memory system.	Needed because it 
  *						allows us to interleave calls from the student's malloc package 
  *						with the system's malloc package in libc.
+ *
+ *						Besides the contiguous heap, it hands out separate
+ *						mappings (mem_map) and keeps track of them, so the
+ *						driver can tell where they are and how large they are.
+ *
+ *						The heap can be backed in several ways (mem_set_backing),
+ *						so the driver can compare what page size and commit
+ *						policy do to the throughput of the same allocator.
  */
+#define _GNU_SOURCE					/* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -16,50 +25,195 @@
 #include "memlib.h"
 #include "config.h"
 
+#define HEAP_HINT	((void *)0x800000000)	/* suggested start, 2 MB aligned */
+#define HUGE_SIZE	(2 * 1024 * 1024)		/* huge page size of x86-64 */
+
+static const char *backing_names[] = {
+	"devzero", "noreserve", "thp", "hugetlb", NULL
+};
+
 /* private variables */
 static char *heap;
 static char *mem_brk;
 static char *mem_max_addr;
+static size_t mem_peak;				/* largest heap plus mapped size since
+									   the last reset */
+static size_t sbrk_calls;			/* mem_sbrk calls since the last reset */
+static char *mem_zero;				/* the heap is all zeros from here on */
+static int backing = MEM_DEVZERO;	/* backing asked for by mem_set_backing */
+static int backing_used = MEM_DEVZERO; /* what mem_init got after fallbacks */
+static int release_on_reset = 0;	/* mem_reset_brk gives the pages back */
+
+/* Mappings handed out by mem_map */
+typedef struct {
+	char *addr;
+	size_t len;
+} mapping_t;
+
+static mapping_t *maps;
+static size_t num_maps;
+static size_t max_maps;
+static size_t mapped_bytes;			/* total length of all the mappings */
+
+static mapping_t *find_map(const void *addr);
+static void update_peak(void);
+static void release_from(char *lo);
+static char *map_heap(int mode);
+
+/*
+ * mem_set_backing - choose how the next mem_init backs the heap:
+ *		MEM_DEVZERO		a private mapping of /dev/zero (the default)
+ *		MEM_NORESERVE	anonymous memory with no swap reserved up front
+ *		MEM_THP			MEM_NORESERVE plus MADV_HUGEPAGE on a 2 MB
+ *						aligned heap, for transparent huge pages
+ *		MEM_HUGETLB		explicit huge pages from the hugetlb pool,
+ *						falling back to MEM_THP if the pool is empty
+ *		With release set, mem_reset_brk gives the heap pages back, so
+ *		every run starts from untouched memory and pays its page faults.
+ */
+void mem_set_backing(int mode, int release) {
+	backing = mode;
+	release_on_reset = release;
+}
+
+/*
+ * mem_backing - the backing mem_init ended up with
+ */
+int mem_backing(void) {
+	return backing_used;
+}
+
+/*
+ * mem_backing_name - name of a backing, or NULL past the last one
+ */
+const char *mem_backing_name(int mode) {
+	if (mode < 0 || mode >= (int)(sizeof(backing_names) / sizeof(char *)))
+		return NULL;
+	return backing_names[mode];
+}
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void){
-	int dev_zero = open("/dev/zero", O_RDWR);
-	heap = mmap((void *)0x800000000, /* suggested start*/
-			MAX_HEAP,				/* length */
-			PROT_WRITE,				/* permissions */
-			MAP_PRIVATE,			/* private or shared? */
-			dev_zero,				/* fd */
-			0);						/* offset (dunno) */
+	int mode;
+
+	/* Fall back to the next weaker backing until one works */
+	for (mode = backing; (heap = map_heap(mode)) == NULL; mode--) {
+		if (mode == MEM_DEVZERO) {
+			fprintf(stderr, "ERROR: mem_init failed to map the heap\n");
+			exit(1);
+		}
+	}
+	backing_used = mode;
 	mem_max_addr = heap + MAX_HEAP;
 	mem_brk = heap;					/* heap is empty initially */
+	mem_zero = heap;
+	mem_peak = 0;
+}
+
+/*
+ * map_heap - map MAX_HEAP bytes for the heap with the given backing.
+ *		Returns NULL if the backing is not available.
+ */
+static char *map_heap(int mode) {
+	int dev_zero;
+	char *p, *aligned;
+
+	switch (mode) {
+	case MEM_DEVZERO:
+		dev_zero = open("/dev/zero", O_RDWR);
+		p = mmap(HEAP_HINT,				/* suggested start*/
+				MAX_HEAP,				/* length */
+				PROT_WRITE,				/* permissions */
+				MAP_PRIVATE,			/* private or shared? */
+				dev_zero,				/* fd */
+				0);						/* offset (dunno) */
+		close(dev_zero);
+		return p == MAP_FAILED ? NULL : p;
+
+	case MEM_NORESERVE:
+		p = mmap(HEAP_HINT, MAX_HEAP, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		return p == MAP_FAILED ? NULL : p;
+
+	case MEM_THP:
+		/* Huge pages need a 2 MB aligned heap, whatever the hint gave */
+		p = mmap(HEAP_HINT, MAX_HEAP + HUGE_SIZE, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (p == MAP_FAILED)
+			return NULL;
+		aligned = (char *)(((size_t)p + HUGE_SIZE - 1) & ~(size_t)(HUGE_SIZE - 1));
+		if (aligned > p)
+			munmap(p, aligned - p);
+		munmap(aligned + MAX_HEAP, p + HUGE_SIZE - aligned);
+		if (madvise(aligned, MAX_HEAP, MADV_HUGEPAGE) != 0) {
+			munmap(aligned, MAX_HEAP);
+			return NULL;
+		}
+		return aligned;
+
+	case MEM_HUGETLB:
+		p = mmap(HEAP_HINT, MAX_HEAP, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		return p == MAP_FAILED ? NULL : p;
+	}
+	return NULL;
 }
 
 /* 
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_deinit(void){
+	mem_reset_brk();
 	munmap(heap, MAX_HEAP);
+	free(maps);
+	maps = NULL;
+	max_maps = 0;
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap,
+ *		and drop every mapping. The heap pages stay, so that timed runs
+ *		do not pay for page faults, unless mem_set_backing said otherwise.
  */
 void mem_reset_brk(){
+	if (release_on_reset)
+		release_from(heap);
 	mem_brk = heap;
+	while (num_maps > 0) {
+		num_maps--;
+		munmap(maps[num_maps].addr, maps[num_maps].len);
+	}
+	mapped_bytes = 0;
+	mem_peak = 0;
+	sbrk_calls = 0;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *		by incr bytes and returns the start address of the new area. In
- *		this model, the heap cannot be shrunk.
+ *		by incr bytes and returns the start address of the new area.
+ *		A negative incr shrinks the heap and gives its pages back.
  */
 void *mem_sbrk(int incr) {
 	char *old_brk = mem_brk;
 
+	sbrk_calls++;
+
+	if (incr < 0) {
+		if (mem_brk + incr < heap) {
+			errno = EINVAL;
+			fprintf(stderr, "ERROR: mem_sbrk failed. Heap shrunk below its start...\n");
+			return (void *)-1;
+		}
+		/* The real brk is left alone: libc may have moved it since */
+		mem_brk += incr;
+		release_from(mem_brk);
+		return (void *)old_brk;
+	}
+
     // call sbrk() in an attempt to have similar semantics as a real allocator.
-	if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr) ||
+	if ( ((mem_brk + incr) > mem_max_addr) ||
             sbrk(incr) == (void *) -1) {
 		errno = ENOMEM;
 		fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
@@ -67,9 +221,164 @@ void *mem_sbrk(int incr) {
 	}
 
 	mem_brk += incr;
+	if (mem_brk > mem_zero)
+		mem_zero = mem_brk;
+	update_peak();
 	return (void *)old_brk;
 }
 
+/*
+ * mem_map - model of an anonymous mmap of len bytes outside the heap.
+ *		The mappings together may not exceed MAX_HEAP bytes.
+ *		Returns the start of the mapping, or (void *)-1 on failure.
+ */
+void *mem_map(size_t len) {
+	char *addr;
+	mapping_t *grown;
+
+	if (mapped_bytes + len > MAX_HEAP) {
+		errno = ENOMEM;
+		fprintf(stderr, "ERROR: mem_map failed. Ran out of memory...\n");
+		return (void *)-1;
+	}
+	if (num_maps == max_maps) {
+		max_maps = max_maps ? 2 * max_maps : 16;
+		if ((grown = realloc(maps, max_maps * sizeof(mapping_t))) == NULL) {
+			max_maps = num_maps;
+			errno = ENOMEM;
+			return (void *)-1;
+		}
+		maps = grown;
+	}
+	addr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED)
+		return (void *)-1;
+
+	maps[num_maps].addr = addr;
+	maps[num_maps].len = len;
+	num_maps++;
+	mapped_bytes += len;
+	update_peak();
+	return addr;
+}
+
+/*
+ * mem_unmap - unmap a mapping returned by mem_map or mem_remap.
+ *		Returns 0 on success, -1 if addr does not start a mapping.
+ */
+int mem_unmap(void *addr) {
+	mapping_t *m = find_map(addr);
+
+	if (m == NULL || m->addr != addr) {
+		errno = EINVAL;
+		return -1;
+	}
+	munmap(m->addr, m->len);
+	mapped_bytes -= m->len;
+	*m = maps[--num_maps];
+	return 0;
+}
+
+/*
+ * mem_remap - resize a mapping to newlen bytes with mremap, moving it
+ *		if it cannot grow in place. Returns the new start of the
+ *		mapping, or (void *)-1 on failure with the old one left intact.
+ */
+void *mem_remap(void *addr, size_t newlen) {
+	mapping_t *m = find_map(addr);
+	char *newaddr;
+
+	if (m == NULL || m->addr != addr) {
+		errno = EINVAL;
+		return (void *)-1;
+	}
+	if (mapped_bytes - m->len + newlen > MAX_HEAP) {
+		errno = ENOMEM;
+		fprintf(stderr, "ERROR: mem_remap failed. Ran out of memory...\n");
+		return (void *)-1;
+	}
+	newaddr = mremap(m->addr, m->len, newlen, MREMAP_MAYMOVE);
+	if (newaddr == MAP_FAILED)
+		return (void *)-1;
+
+	mapped_bytes = mapped_bytes - m->len + newlen;
+	m->addr = newaddr;
+	m->len = newlen;
+	update_peak();
+	return newaddr;
+}
+
+/*
+ * mem_is_mapped - check that [lo, lo+len) lies within a single mapping
+ */
+int mem_is_mapped(const void *lo, size_t len) {
+	mapping_t *m = find_map(lo);
+
+	return m != NULL && (const char *)lo + len <= m->addr + m->len;
+}
+
+/*
+ * find_map - return the mapping that contains addr, or NULL
+ */
+static mapping_t *find_map(const void *addr) {
+	size_t i;
+
+	for (i = 0; i < num_maps; i++) {
+		if ((const char *)addr >= maps[i].addr &&
+			(const char *)addr < maps[i].addr + maps[i].len)
+			return &maps[i];
+	}
+	return NULL;
+}
+
+/*
+ * update_peak - fold the current footprint into the high-water mark
+ */
+static void update_peak(void) {
+	size_t size = mem_heapsize() + mapped_bytes;
+
+	if (size > mem_peak)
+		mem_peak = size;
+}
+
+/*
+ * mem_release - tell the kernel the whole pages inside [addr, addr+len)
+ *		are unused. They stay mapped and read back as zeros.
+ *		Returns the number of bytes released.
+ */
+size_t mem_release(void *addr, size_t len) {
+	size_t pagesize = mem_pagesize();
+	char *lo = (char *)(((size_t)addr + pagesize - 1) & ~(pagesize - 1));
+	char *hi = (char *)(((size_t)addr + len) & ~(pagesize - 1));
+
+	if (hi <= lo || madvise(lo, hi - lo, MADV_DONTNEED) != 0)
+		return 0;
+	return (size_t)(hi - lo);
+}
+
+/*
+ * release_from - give back the pages from lo up to the part of the heap
+ *		that was never written. The heap then reads as zeros from the
+ *		first page boundary at or above lo.
+ */
+static void release_from(char *lo) {
+	size_t pagesize = mem_pagesize();
+	char *lo_page = (char *)(((size_t)lo + pagesize - 1) & ~(pagesize - 1));
+	char *hi = (char *)(((size_t)mem_zero + pagesize - 1) & ~(pagesize - 1));
+
+	if (hi > lo_page && mem_release(lo, hi - lo) == (size_t)(hi - lo_page))
+		mem_zero = lo_page;
+}
+
+/*
+ * mem_zero_lo - return the address from which the heap, up to its end
+ *		and beyond, has not been written since it was last zero
+ */
+void *mem_zero_lo(){
+	return (void *)mem_zero;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -91,6 +400,29 @@ size_t mem_heapsize() {
 	return (size_t)((void *)mem_brk - (void *)heap);
 }
 
+/*
+ * mem_mapsize() - returns the total size of the mappings in bytes
+ */
+size_t mem_mapsize() {
+	return mapped_bytes;
+}
+
+/*
+ * mem_peak_heapsize() - returns the largest heap plus mapped size in
+ *		bytes since the last reset
+ */
+size_t mem_peak_heapsize() {
+	return mem_peak;
+}
+
+/*
+ * mem_sbrk_calls() - returns the number of mem_sbrk calls since the
+ *		last reset
+ */
+size_t mem_sbrk_calls() {
+	return sbrk_calls;
+}
+
 /*
  * mem_pagesize() - returns the page size of the system
  */
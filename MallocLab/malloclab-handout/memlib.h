@@ -1,11 +1,26 @@
 #include <unistd.h>
 
+/* Heap backings for mem_set_backing, each falls back to the one before */
+enum { MEM_DEVZERO, MEM_NORESERVE, MEM_THP, MEM_HUGETLB };
+
+void mem_set_backing(int mode, int release);
+int mem_backing(void);
+const char *mem_backing_name(int mode);
 void mem_init(void);               
 void mem_deinit(void);
 void *mem_sbrk(int incr);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
+void *mem_zero_lo(void);
 size_t mem_heapsize(void);
+size_t mem_mapsize(void);
+size_t mem_peak_heapsize(void);
+size_t mem_sbrk_calls(void);
+void *mem_map(size_t len);
+int mem_unmap(void *addr);
+void *mem_remap(void *addr, size_t newlen);
+int mem_is_mapped(const void *lo, size_t len);
+size_t mem_release(void *addr, size_t len);
 size_t mem_pagesize(void);
 
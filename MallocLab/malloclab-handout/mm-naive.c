@@ -10,6 +10,7 @@
  * it never frees anything.
  */
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -34,6 +35,10 @@
 #define free mm_free
 #define realloc mm_realloc
 #define calloc mm_calloc
+#define memalign mm_memalign
+#define posix_memalign mm_posix_memalign
+#define aligned_alloc mm_aligned_alloc
+#define free_sized mm_free_sized
 #endif /* def DRIVER */
 
 /* single word (4) or double word (8) alignment */
@@ -135,6 +140,103 @@ void *calloc (size_t nmemb, size_t size)
     return newptr;
 }
 
+/*
+ * memalign - Allocate enough to round the payload up to align bytes,
+ *      with its size in the word before it as usual.
+ */
+void *memalign(size_t align, size_t size)
+{
+    unsigned char *p;
+
+    if ((align & (align - 1)) != 0)
+        return NULL;
+    if (align <= ALIGNMENT)
+        return malloc(size);
+    if ((p = malloc(size + align)) == NULL)
+        return NULL;
+    p = (unsigned char *)(((size_t)p + align - 1) & ~(align - 1));
+    *SIZE_PTR(p) = size;
+    return p;
+}
+
+/*
+ * posix_memalign - memalign that reports errors instead of returning NULL
+ */
+int posix_memalign(void **memptr, size_t align, size_t size)
+{
+    void *p;
+
+    if (align % sizeof(void *) != 0 || (align & (align - 1)) != 0)
+        return EINVAL;
+    if ((p = memalign(align, size)) == NULL)
+        return ENOMEM;
+    *memptr = p;
+    return 0;
+}
+
+/*
+ * aligned_alloc - The C11 name of memalign
+ */
+void *aligned_alloc(size_t align, size_t size)
+{
+    return memalign(align, size);
+}
+
+/*
+ * free_sized - Ignored, like free.
+ */
+void free_sized(void *ptr, size_t size)
+{
+    free(ptr);
+}
+
+/*
+ * mm_set_mmap_threshold - Nothing is mapped, so nothing to set.
+ */
+void mm_set_mmap_threshold(size_t threshold)
+{
+}
+
+/*
+ * mm_trim - Nothing is ever freed, so nothing to release.
+ */
+size_t mm_trim(size_t pad)
+{
+    return 0;
+}
+
+/*
+ * mm_malloc_batch - Allocate n blocks one at a time.
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void **out)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if ((out[i] = malloc(size)) == NULL)
+            break;
+    }
+    return i;
+}
+
+/*
+ * mm_free_batch - Ignored, like free.
+ */
+void mm_free_batch(void **ptrs, size_t n)
+{
+}
+
+/*
+ * mm_heap_info - The heap is all allocated blocks.
+ */
+void mm_heap_info(mm_heap_info_t *info)
+{
+    memset(info, 0, sizeof(*info));
+    info->heap_bytes = mem_heapsize();
+}
+
+const int mm_thread_safe = 0;
+
 /*
  * mm_checkheap - There are no bugs in my code, so I don't need to
  *      check, so nah! (But if I did, I could call this function using
@@ -2,8 +2,11 @@
  * Simple, 32-bit and 64-bit clean allocator based on implicit free
  * lists, first-fit placement, and boundary tag coalescing, as described
  * in the CS:APP3e text. Blocks must be aligned to doubleword (8 byte) 
- * boundaries. Minimum block size is 16 bytes. 
+ * boundaries. Only free blocks carry a footer: each header records
+ * whether the previous block is allocated instead. Minimum block size
+ * is 8 bytes. 
  */
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -18,6 +21,10 @@
 #define free mm_free
 #define realloc mm_realloc
 #define calloc mm_calloc
+#define memalign mm_memalign
+#define posix_memalign mm_posix_memalign
+#define aligned_alloc mm_aligned_alloc
+#define free_sized mm_free_sized
 #endif /* def DRIVER */
 
 /*
@@ -43,11 +50,19 @@
 #define GET_SIZE(p)  (GET(p) & ~0x7)                   
 #define GET_ALLOC(p) (GET(p) & 0x1)                    
 
-/* Given block ptr bp, compute address of its header and footer */
+/* Read and update the previous-block-allocated bit at address p */
+#define PREV_ALLOC         0x2
+#define GET_PREV_ALLOC(p)  (GET(p) & PREV_ALLOC)
+#define SET_PREV_ALLOC(p)  (GET(p) |= PREV_ALLOC)
+#define CLR_PREV_ALLOC(p)  (GET(p) &= ~PREV_ALLOC)
+
+/* Given block ptr bp, compute address of its header and footer
+   (free blocks only) */
 #define HDRP(bp)       ((char *)(bp) - WSIZE)                      
 #define FTRP(bp)       ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE) 
 
-/* Given block ptr bp, compute address of next and previous blocks */
+/* Given block ptr bp, compute address of next and previous blocks
+   (previous block must be free) */
 #define NEXT_BLKP(bp)  ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE))) 
 #define PREV_BLKP(bp)  ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE))) 
 
@@ -72,9 +87,9 @@ int mm_init(void)
     if ((heap_listp = mem_sbrk(4*WSIZE)) == (void *)-1) 
         return -1;
     PUT(heap_listp, 0);                          /* Alignment padding */
-    PUT(heap_listp + (1*WSIZE), PACK(DSIZE, 1)); /* Prologue header */ 
+    PUT(heap_listp + (1*WSIZE), PACK(DSIZE, PREV_ALLOC | 1)); /* Prologue header */ 
     PUT(heap_listp + (2*WSIZE), PACK(DSIZE, 1)); /* Prologue footer */ 
-    PUT(heap_listp + (3*WSIZE), PACK(0, 1));     /* Epilogue header */
+    PUT(heap_listp + (3*WSIZE), PACK(0, PREV_ALLOC | 1));     /* Epilogue header */
     heap_listp += (2*WSIZE);                     
 
 #ifdef NEXT_FIT
@@ -103,11 +118,8 @@ void *malloc(size_t size)
     if (size == 0)
         return NULL;
 
-    /* Adjust block size to include overhead and alignment reqs. */
-    if (size <= DSIZE)                                          
-        asize = 2 * DSIZE;
-    else
-        asize = DSIZE * ((size + (DSIZE) + (DSIZE-1)) / DSIZE); 
+    /* Adjust block size to include header and alignment reqs. */
+    asize = DSIZE * ((size + (WSIZE) + (DSIZE-1)) / DSIZE); 
 
     /* Search the free list for a fit */
     if ((bp = find_fit(asize)) != NULL) {  
@@ -136,8 +148,9 @@ void free(void *bp)
         mm_init();
     }
 
-    PUT(HDRP(bp), PACK(size, 0));
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
     PUT(FTRP(bp), PACK(size, 0));
+    CLR_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
     coalesce(bp);
 }
 
@@ -168,7 +181,7 @@ void *realloc(void *ptr, size_t size)
     }
 
     /* Copy the old data. */
-    oldsize = GET_SIZE(HDRP(ptr));
+    oldsize = GET_SIZE(HDRP(ptr)) - WSIZE;
     if(size < oldsize) oldsize = size;
     memcpy(newptr, ptr, oldsize);
 
@@ -188,6 +201,157 @@ void mm_checkheap(int lineno)
     lineno = lineno; /* keep gcc happy */
 }
 
+/*
+ * The rest of the interface mdriver calls, built on malloc and free
+ */
+
+const int mm_thread_safe = 0;
+
+/*
+ * calloc - Allocate the block and set it to zero
+ */
+void *calloc(size_t nmemb, size_t size)
+{
+    size_t bytes = nmemb * size;
+    void *bp;
+
+    if ((bp = malloc(bytes)) != NULL)
+        memset(bp, 0, bytes);
+    return bp;
+}
+
+/*
+ * memalign - Allocate a block whose payload is aligned to align bytes:
+ *            malloc room for any leading fragment, then free the
+ *            fragments before and after the aligned block
+ */
+void *memalign(size_t align, size_t size)
+{
+    size_t asize, csize, lead;
+    char *bp, *abp;
+
+    if (align <= DSIZE)
+        return malloc(size);
+    if ((align & (align - 1)) != 0 || size == 0)
+        return NULL;
+    if ((bp = malloc(size + align + DSIZE)) == NULL)
+        return NULL;
+
+    /* A leading fragment must be big enough to be a free block */
+    abp = bp;
+    if ((size_t)bp % align != 0)
+        abp = (char *)(((size_t)bp + DSIZE + align - 1) & ~(align - 1));
+    csize = GET_SIZE(HDRP(bp));
+    lead = abp - bp;
+    if (lead > 0) {
+        PUT(HDRP(abp), PACK(csize - lead, 1));
+        PUT(HDRP(bp), PACK(lead, GET_PREV_ALLOC(HDRP(bp)) | 1));
+        free(bp);
+        csize -= lead;
+    }
+
+    asize = DSIZE * ((size + (WSIZE) + (DSIZE-1)) / DSIZE);
+    if (csize - asize >= DSIZE) {
+        PUT(HDRP(abp), PACK(asize, GET_PREV_ALLOC(HDRP(abp)) | 1));
+        PUT(HDRP(NEXT_BLKP(abp)), PACK(csize - asize, PREV_ALLOC | 1));
+        free(NEXT_BLKP(abp));
+    }
+    return abp;
+}
+
+/*
+ * posix_memalign - memalign that reports errors instead of returning NULL
+ */
+int posix_memalign(void **memptr, size_t align, size_t size)
+{
+    void *bp;
+
+    if (align % sizeof(void *) != 0 || (align & (align - 1)) != 0)
+        return EINVAL;
+    if ((bp = memalign(align, size)) == NULL && size != 0)
+        return ENOMEM;
+    *memptr = bp;
+    return 0;
+}
+
+/*
+ * aligned_alloc - The C11 name of memalign
+ */
+void *aligned_alloc(size_t align, size_t size)
+{
+    return memalign(align, size);
+}
+
+/*
+ * free_sized - free, which has the size in the header anyway
+ */
+void free_sized(void *bp, size_t size)
+{
+    free(bp);
+}
+
+/*
+ * mm_set_mmap_threshold - Every block lives in the heap, so ignore it
+ */
+void mm_set_mmap_threshold(size_t threshold)
+{
+}
+
+/*
+ * mm_trim - The heap never shrinks, so nothing is released
+ */
+size_t mm_trim(size_t pad)
+{
+    return 0;
+}
+
+/*
+ * mm_malloc_batch - Allocate n blocks of size bytes one at a time
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void **out)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if ((out[i] = malloc(size)) == NULL)
+            break;
+    }
+    return i;
+}
+
+/*
+ * mm_free_batch - Free n blocks one at a time
+ */
+void mm_free_batch(void **ptrs, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        free(ptrs[i]);
+}
+
+/*
+ * mm_heap_info - Walk the heap; its free blocks all go in class 0, as
+ *                there is a single implicit list
+ */
+void mm_heap_info(mm_heap_info_t *info)
+{
+    char *bp;
+    size_t size;
+
+    memset(info, 0, sizeof(*info));
+    info->heap_bytes = mem_heapsize();
+    if (heap_listp == 0)
+        return;
+    for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+        if (GET_ALLOC(HDRP(bp)))
+            continue;
+        size = GET_SIZE(HDRP(bp));
+        info->free_bytes[0] += size;
+        info->largest_free = MAX(info->largest_free, size);
+    }
+}
+
 /* 
  * The remaining routines are internal helper routines 
  */
@@ -206,7 +370,7 @@ static void *extend_heap(size_t words)
         return NULL;                                        
 
     /* Initialize free block header/footer and the epilogue header */
-    PUT(HDRP(bp), PACK(size, 0));         /* Free block header */   
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp)))); /* Free block header */   
     PUT(FTRP(bp), PACK(size, 0));         /* Free block footer */   
     PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* New epilogue header */ 
 
@@ -219,7 +383,7 @@ static void *extend_heap(size_t words)
  */
 static void *coalesce(void *bp) 
 {
-    size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
     size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
     size_t size = GET_SIZE(HDRP(bp));
 
@@ -229,22 +393,22 @@ static void *coalesce(void *bp)
 
     else if (prev_alloc && !next_alloc) {      /* Case 2 */
         size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
-        PUT(HDRP(bp), PACK(size, 0));
+        PUT(HDRP(bp), PACK(size, prev_alloc));
         PUT(FTRP(bp), PACK(size,0));
     }
 
     else if (!prev_alloc && next_alloc) {      /* Case 3 */
         size += GET_SIZE(HDRP(PREV_BLKP(bp)));
         PUT(FTRP(bp), PACK(size, 0));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
+        PUT(HDRP(PREV_BLKP(bp)), PACK(size, GET_PREV_ALLOC(HDRP(PREV_BLKP(bp)))));
         bp = PREV_BLKP(bp);
     }
 
     else {                                     /* Case 4 */
         size += GET_SIZE(HDRP(PREV_BLKP(bp))) + 
-            GET_SIZE(FTRP(NEXT_BLKP(bp)));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
-        PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
+            GET_SIZE(HDRP(NEXT_BLKP(bp)));
+        PUT(HDRP(PREV_BLKP(bp)), PACK(size, GET_PREV_ALLOC(HDRP(PREV_BLKP(bp)))));
+        PUT(FTRP(PREV_BLKP(bp)), PACK(size, 0));
         bp = PREV_BLKP(bp);
     }
 #ifdef NEXT_FIT
@@ -263,17 +427,17 @@ static void *coalesce(void *bp)
 static void place(void *bp, size_t asize)
 {
     size_t csize = GET_SIZE(HDRP(bp));   
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
 
-    if ((csize - asize) >= (2*DSIZE)) { 
-        PUT(HDRP(bp), PACK(asize, 1));
-        PUT(FTRP(bp), PACK(asize, 1));
+    if ((csize - asize) >= DSIZE) { 
+        PUT(HDRP(bp), PACK(asize, prev_alloc | 1));
         bp = NEXT_BLKP(bp);
-        PUT(HDRP(bp), PACK(csize-asize, 0));
+        PUT(HDRP(bp), PACK(csize-asize, PREV_ALLOC));
         PUT(FTRP(bp), PACK(csize-asize, 0));
     }
     else { 
-        PUT(HDRP(bp), PACK(csize, 1));
-        PUT(FTRP(bp), PACK(csize, 1));
+        PUT(HDRP(bp), PACK(csize, prev_alloc | 1));
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
     }
 }
 
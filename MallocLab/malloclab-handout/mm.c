@@ -8,7 +8,38 @@
  *            on the free list and coalesced if needed. When allocating, 
  *            free list are checked for first fit block starting from 
  *            correct seg list for the size and iterating over other lists.
- *            If no free node found, memory is extended by chunk size.
+ *            If no free node found, the heap is extended by grow_size
+ *            or the request, whichever is larger. grow_size doubles
+ *            after a few extensions in a row were used up entirely, up
+ *            to a fraction of the heap size, and halves whenever free
+ *            leaves a block at least that large at the top.
+ *
+ *            Free blocks too large for the last seg list are kept in a
+ *            splay tree instead, ordered by (size, address) and linked
+ *            through the same two words as the lists, so they get a
+ *            best fit in amortized O(log n).
+ *
+ *            A free block of at least trim_threshold bytes at the top
+ *            of the heap is given back to memlib, keeping TRIM_PAD bytes.
+ *            The threshold doubles whenever the heap has to grow again
+ *            after a trim, so a heap that keeps bouncing stops trimming.
+ *            mm_trim (malloc_trim) also releases the pages inside the
+ *            other free blocks of at least RELEASE_MIN bytes.
+ *
+ *            Requests of at least mmap_threshold bytes bypass the heap and
+ *            get a mapping of their own from memlib, with the MAPPED bit
+ *            set in their header. Realloc resizes them with mremap.
+ *
+ *            Requests of at most SLAB_MAX_SIZE bytes are carved out of
+ *            slab runs: RUN_SIZE-aligned blocks holding equal-sized
+ *            objects with no header or footer, whose free objects are
+ *            tracked by a bitmap in the run header. Until the heap reaches
+ *            SLAB_MIN_HEAP bytes, a class with no run yet gets ordinary
+ *            blocks instead, as one run would be much of a small heap.
+ *
+ *            Built without DRIVER, the functions keep their libc names and
+ *            the file is the malloc of a real process (libmm.so), with the
+ *            rest of the malloc.h family as thin wrappers at the end.
  */
 
 #include <assert.h>
@@ -17,9 +48,15 @@
 #include <string.h>
 #include <unistd.h>
 #include <limits.h>
+#include <errno.h>
+
+#ifdef THREAD_SAFE
+#include <pthread.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
+#include "config.h"
 
 /* If you want debugging output, use the following macro.  When you hand
  * in, remove the #define DEBUG line. */
@@ -38,19 +75,48 @@
 #define free mm_free
 #define realloc mm_realloc
 #define calloc mm_calloc
+#define memalign mm_memalign
+#define posix_memalign mm_posix_memalign
+#define aligned_alloc mm_aligned_alloc
+#define free_sized mm_free_sized
+#define malloc_usable_size mm_malloc_usable_size
 #endif /* def DRIVER */
 
 /* $begin mallocmacros */
 /* Basic constants and macros */
 #define WSIZE                    4       /* Word and header/footer size (bytes) */
 #define DSIZE                    8       /* Doubleword size (bytes) */
-#define CHUNKSIZE                168     /* Extend heap by this amount (bytes) */
-#define MIN_BLOCK_SIZE           (3*DSIZE)
+#define CHUNKSIZE                168     /* Extend heap by at least this amount (bytes) */
+#define GROW_MAX                 (64*1024) /* Most grow_size can reach */
+#define GROW_STREAK              2       /* Full extensions in a row before growing */
+#define GROW_FRACTION            16      /* grow_size stays below heap size / this */
+#define MIN_BLOCK_SIZE           (2*DSIZE)
+#define SEG_LIST_BASE            16      /* List i holds blocks of at most
+                                            SEG_LIST_BASE << i bytes */
 #define SEG_LIST_SIZE_DIFF       32
-#define LISTSIZE                 14
+#define LISTSIZE                 8       /* Seg lists, the last one is the tree */
+#define TREE_INDEX               (LISTSIZE-1)
+#define TRIM_THRESHOLD           (128*1024)  /* Initial top block size that
+                                               shrinks the heap */
+#define TRIM_THRESHOLD_MAX       (32*1024*1024)
+#define TRIM_PAD                 (128*1024)  /* Bytes of the top block kept by a trim */
+#define RELEASE_MIN              (64*1024)   /* Least free block size whose
+                                               pages mm_trim releases */
+#define MMAP_THRESHOLD           (128*1024)  /* Default request size that gets
+                                               its own mapping */
+#define BATCH_MAX_BYTES          (256*1024)  /* Most a batch takes out of one
+                                               free block */
+
+/* Largest heap memlib can give us: the simulator's, or a real process's */
+#ifdef DRIVER
+#define HEAP_MAX                 ((size_t)MAX_HEAP)
+#else
+#define HEAP_MAX                 ((size_t)OS_MAX_HEAP)
+#endif
 
 
 #define MAX(x, y) ((x) > (y)? (x) : (y))  
+#define MIN(x, y) ((x) < (y)? (x) : (y))
 
 /* Word alignment */
 #define ALIGNMENT 8
@@ -69,39 +135,230 @@
 #define GET_SIZE(p)  (GET(p) & ~0x7)
 #define GET_ALLOC(p) (GET(p) & 0x1)
 
-/* Given block ptr bp, compute address of its header and footer */
+/**
+ * Bit 1 of a header records whether the previous block is allocated.
+ * Allocated blocks have no footer, so this is the only way to tell if
+ * the previous block can be coalesced.
+ */
+#define PREV_ALLOC               0x2
+#define GET_PREV_ALLOC(p)        (GET(p) & PREV_ALLOC)
+#define SET_PREV_ALLOC(p)        (GET(p) |= PREV_ALLOC)
+#define CLR_PREV_ALLOC(p)        (GET(p) &= ~PREV_ALLOC)
+
+/**
+ * Bit 2 of a header marks a block with a mapping of its own. The mapping
+ * starts DSIZE bytes before the payload, and the size field of the header
+ * holds the length of the whole mapping.
+ */
+#define MAPPED                   0x4
+#define IS_MAPPED(p)             (GET(p) & MAPPED)
+#define MAP_START(bp)            ((char *)(bp) - DSIZE)
+
+/* Given block ptr bp, compute address of its header and footer.
+ * Only free blocks have a footer. */
 #define HDRP(bp)       ((char *)(bp) - WSIZE)
 #define FTRP(bp)       ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 
-/* Given block ptr bp from heap, compute address of next and previous blocks */
+/* Given block ptr bp from heap, compute address of next and previous blocks.
+ * PREV_BLKP reads the previous block's footer, so that block must be free. */
 #define NEXT_BLKP(bp)  ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
 #define PREV_BLKP(bp)  ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
 
-/* Given block ptr bp, compter address of its previous and next allocated blocks */
-#define PREV_ALLOC(bp) (GET(bp) & 0x2)
-#define NEXT_ALLOC(bp) (GET(bp) & 0x4)
+/**
+ * Given block ptr bp, compute the first align-aligned block pointer at or
+ * after it that leaves either no leading fragment or room for a free block
+ */
+#define ALIGNED_BLKP(bp, align) \
+    ((size_t)(bp) % (align) == 0 ? (char *)(bp) : \
+     (char *)(((size_t)(bp) + MIN_BLOCK_SIZE + (align) - 1) & ~((align) - 1)))
+
+/**
+ * Free blocks link to each other with 32-bit offsets from free_listp, the
+ * start of the heap, with 0 standing for NULL. HEAP_MAX keeps every offset
+ * inside 32 bits, and a free block fits in 2 words of links plus its
+ * header and footer.
+ */
+#define LINK_OFFSET(p)              ((p) == NULL ? 0u : \
+                                     (unsigned int)((char *)(p) - free_listp))
+#define LINK_BLKP(off)              ((off) == 0 ? NULL : free_listp + (off))
+
+/* Given block ptr bp from segregated free lists, compute address of its links */
+#define PREV_LINK(bp)               (*(unsigned int *)(bp))
+#define NEXT_LINK(bp)               (*(unsigned int *)((char *)(bp) + WSIZE))
 
 /* Given block ptr bp from segregated free lists, compter address of next and previous blocks */
-#define NEXT_SEGBLKP(bp)            (*(char **)((char *)bp + DSIZE))
-#define PREV_SEGBLKP(bp)            (*(char **)bp)
+#define NEXT_SEGBLKP(bp)            LINK_BLKP(NEXT_LINK(bp))
+#define PREV_SEGBLKP(bp)            LINK_BLKP(PREV_LINK(bp))
+#define SET_NEXT_SEGBLKP(bp, p)     (NEXT_LINK(bp) = LINK_OFFSET(p))
+#define SET_PREV_SEGBLKP(bp, p)     (PREV_LINK(bp) = LINK_OFFSET(p))
 
 #define SEGBLKP(free_listp, index)   (*(char **)(free_listp + (index*DSIZE)))
 
+/* Given block ptr bp from the tree, compute its children */
+#define LEFT_LINK(bp)               PREV_LINK(bp)
+#define RIGHT_LINK(bp)              NEXT_LINK(bp)
+#define LEFT_CHILD(bp)              PREV_SEGBLKP(bp)
+#define RIGHT_CHILD(bp)             NEXT_SEGBLKP(bp)
+#define SET_LEFT_CHILD(bp, p)       SET_PREV_SEGBLKP(bp, p)
+#define SET_RIGHT_CHILD(bp, p)      SET_NEXT_SEGBLKP(bp, p)
+
+/* Order of the tree: is block (size, bp) before block n */
+#define KEY_LT(size, bp, n) \
+    ((size) < GET_SIZE(HDRP(n)) || \
+     ((size) == GET_SIZE(HDRP(n)) && (char *)(bp) < (char *)(n)))
+
+/* Slab runs for tiny requests */
+#define SLAB_MAX_SIZE            64      /* Largest request served from a slab */
+#define SLAB_CLASSES             (SLAB_MAX_SIZE/DSIZE)
+#define RUN_SIZE                 512     /* Block size of a run, also the
+                                            alignment of its payload */
+#define SLAB_MIN_HEAP            (16*1024) /* Heap size before a class
+                                              gets its first run */
+#define RUN_HDR_SIZE             ALIGN(sizeof(slab_run_t))
+#define RUN_OBJ_BYTES            (RUN_SIZE - RUN_HDR_SIZE - WSIZE)
+
+/* Object size of a tiny request, and the index of its slab class */
+#define SLAB_OBJSIZE(size)       ALIGN(size)
+#define SLAB_CLASS(objsize)      ((objsize)/DSIZE - 1)
+
+/* Given an object ptr, compute the address of its run */
+#define RUNP(bp)                 ((slab_run_t *)((size_t)(bp) & ~(size_t)(RUN_SIZE-1)))
+#define RUN_INDEX(bp)            (((char *)(bp) - free_listp) / RUN_SIZE)
+
+/*
+ * Thread-safe build: every operation on the heap is serialized by heap_lock,
+ * and each thread keeps a small cache of recently freed blocks, binned by
+ * exact block size. Cached blocks stay marked allocated in the heap, so a
+ * hit in the cache never touches the seg lists or the lock.
+ */
+#ifdef THREAD_SAFE
+#define TCACHE_MAX_SIZE          256     /* Largest block size kept in a thread cache */
+#define TCACHE_BINS              (TCACHE_MAX_SIZE/DSIZE + 1)
+#define TCACHE_FILL              8       /* Max blocks kept per bin */
+
+/* Cached blocks are linked through the first word of their payload */
+#define TCACHE_NEXT(bp)          (*(char **)(bp))
+
+#define HEAP_LOCK()              pthread_mutex_lock(&heap_lock)
+#define HEAP_UNLOCK()            pthread_mutex_unlock(&heap_lock)
+#else
+#define tcache_get(asize)        NULL
+#define tcache_put(bp, size)     0
+#define HEAP_LOCK()
+#define HEAP_UNLOCK()
+#endif
+
+#if MM_CLASSES != LISTSIZE
+#error "MM_CLASSES must match LISTSIZE"
+#endif
+
+/*
+ * Stats build: counters for mm_get_stats. They are updated with relaxed
+ * atomics, since realloc copies outside heap_lock, and compile to
+ * nothing otherwise.
+ */
+#ifdef MM_STATS
+#define STAT_ADD(field, n)       __atomic_add_fetch(&stats.field, (n), __ATOMIC_RELAXED)
+#define STAT_INC(field)          STAT_ADD(field, 1)
+#define STAT_PROBE()             (fit_probes++)
+#define STAT_FIT(asize, bp)      stat_fit(asize, bp)
+#else
+#define STAT_ADD(field, n)
+#define STAT_INC(field)
+#define STAT_PROBE()
+#define STAT_FIT(asize, bp)
+#endif
+
 /* Global variables */
 static char *heap_listp = 0;  /* Pointer to first block */
 static char *free_listp = 0;    /* Pointer to first block of seg list*/
+static size_t trim_threshold = TRIM_THRESHOLD; /* Top block size free trims at */
+static int trimmed = 0;         /* Has free trimmed since the last extend_heap */
+static size_t grow_size = CHUNKSIZE; /* Least amount malloc extends the heap by */
+static int grow_streak = 0;     /* Extensions in a row that were used up */
+static size_t mmap_threshold = MMAP_THRESHOLD; /* Requests of this size get
+                                                  their own mapping */
+static unsigned int seg_bitmap = 0; /* Bit i is set iff seg list i is non-empty */
+static char *zero_lo = 0;       /* Heap is zero from here to the epilogue, but
+                                   for the header, links and footer of the
+                                   free block there */
+static char *placed_zero = 0;   /* Heap is zero from here to the end of the
+                                   block place() last handed out */
+#ifdef MM_STATS
+static mm_stats_t stats;               /* Counters for mm_get_stats */
+static unsigned long fit_probes;       /* Blocks visited by the last fit search */
+#endif
+
+typedef struct slab_run {
+    unsigned long freemap;             /* Bit i is set iff object i is free */
+    struct slab_run *next;             /* Runs of this class with free objects */
+    struct slab_run *prev;
+    unsigned int objsize;              /* Object size in bytes */
+    unsigned int nobjs;                /* Objects in the run, at most 64 */
+} slab_run_t;
+
+static slab_run_t *slab_runs[SLAB_CLASSES]; /* Runs with a free object, per class */
+static unsigned char slab_map[HEAP_MAX / RUN_SIZE / CHAR_BIT]; /* Bit per run-sized
+                                                               chunk of heap */
+static size_t slab_map_len = 0;        /* Bytes of slab_map that may be set */
 
 #ifdef NEXT_FIT
     static char *rover;           /* Next fit rover */
 #endif
 
+#ifdef THREAD_SAFE
+typedef struct {
+    unsigned long gen;                 /* heap_gen the cached blocks belong to */
+    char *bins[TCACHE_BINS];           /* bins[i] holds blocks or slab objects
+                                          of i*DSIZE bytes */
+    unsigned char counts[TCACHE_BINS];
+} tcache_t;
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long heap_gen = 1;     /* Bumped by mm_init, invalidates caches */
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcache_key;       /* Flushes a thread's cache on exit */
+static __thread tcache_t tcache;
+
+const int mm_thread_safe = 1;
+#else
+const int mm_thread_safe = 0;
+#endif
+
 
 /* Function prototypes for internal helper routines */
+static int init_heap(void);
+static void *alloc_block(size_t asize);
+static void free_block(void *bp);
+static void free_ptr(void *bp, size_t objsize);
+static void back_off(void);
+static size_t carve_batch(size_t asize, size_t n, void **out);
+static void sort_blocks(void **v, size_t n);
+static void sift_down(void **v, size_t root, size_t n);
+static size_t trim_heap(size_t pad, size_t min);
+static void *map_block(size_t size);
+static void *remap_block(void *bp, size_t size);
+static void *alloc_aligned(size_t asize, size_t align);
+static size_t usable_size(void *bp);
+static void *extend_aligned(size_t asize, size_t align);
+static void *find_fit_aligned(size_t asize, size_t align);
+static void shrink_block(void *bp, size_t asize);
+static void *resize_block(void *bp, size_t asize);
+static void *slab_alloc(size_t objsize);
+static void slab_free(void *bp);
+static int is_slab(const void *bp);
 static void *extend_heap(size_t words);
 static void place(void *bp, size_t asize);
+static void check_sized(void *bp, size_t size, int slab);
 static void checkblock(void *bp);
 static void *list_add(void *bp);
 static void list_delete(void *bp);
+static char *tree_splay(char *t, size_t size, const void *bp);
+static void tree_insert(void *bp);
+static void tree_delete(void *bp);
+static void *tree_fit(size_t asize);
+static size_t check_tree(char *t, char *lo, char *hi);
+static size_t tree_bytes(char *t);
 static void *mm_coalesce(void *bp) ;
 static unsigned int get_list_index(size_t asize);
 static void *find_fit(size_t asize);
@@ -109,6 +366,13 @@ static int in_heap(const void *p);
 static void check_cycle();
 static void check_seg_pointers();
 static void check_count_free_list();
+#ifdef THREAD_SAFE
+static void *tcache_get(size_t asize);
+static int tcache_put(void *bp, size_t size);
+#endif
+#ifdef MM_STATS
+static void stat_fit(size_t asize, void *bp);
+#endif
 
 
 /**
@@ -116,6 +380,25 @@ static void check_count_free_list();
  * @return  -1 on error, 0 on success.
  */
 int mm_init(void) {
+    int ret;
+
+    HEAP_LOCK();
+    ret = init_heap();
+#ifdef THREAD_SAFE
+    /* Blocks still sitting in thread caches belong to the old heap */
+    __atomic_add_fetch(&heap_gen, 1, __ATOMIC_RELEASE);
+#endif
+    HEAP_UNLOCK();
+    return ret;
+}
+
+
+/**
+ * init_heap - Create the seg list heads and the initial empty heap.
+ *             Caller must hold heap_lock.
+ * @return  -1 on error, 0 on success.
+ */
+static int init_heap(void) {
     
     /* Create the initial empty heap */
     if ((free_listp = mem_sbrk(LISTSIZE*DSIZE)) == (void *)-1)
@@ -126,6 +409,21 @@ int mm_init(void) {
     {
         SEGBLKP(free_listp,i) = NULL;
     }
+    seg_bitmap = 0;
+    trim_threshold = TRIM_THRESHOLD;
+    trimmed = 0;
+    grow_size = CHUNKSIZE;
+    grow_streak = 0;
+#ifdef MM_STATS
+    memset(&stats, 0, sizeof(stats));
+#endif
+
+    /*Forget the slab runs of the previous heap*/
+    for (int i = 0; i < SLAB_CLASSES; i++) {
+        slab_runs[i] = NULL;
+    }
+    memset(slab_map, 0, slab_map_len);
+    slab_map_len = 0;
 
     heap_listp = free_listp + LISTSIZE*DSIZE;
     
@@ -133,9 +431,9 @@ int mm_init(void) {
     if ((heap_listp = mem_sbrk(4*WSIZE)) == (void *)-1) 
         return -1;
     PUT(heap_listp, 0);                          /* Alignment padding */
-    PUT(heap_listp + (1*WSIZE), PACK(DSIZE, 1)); /* Prologue header */ 
+    PUT(heap_listp + (1*WSIZE), PACK(DSIZE, PREV_ALLOC | 1)); /* Prologue header */ 
     PUT(heap_listp + (2*WSIZE), PACK(DSIZE, 1)); /* Prologue footer */ 
-    PUT(heap_listp + (3*WSIZE), PACK(0, 1));     /* Epilogue header */
+    PUT(heap_listp + (3*WSIZE), PACK(0, PREV_ALLOC | 1));     /* Epilogue header */
     heap_listp += (2*WSIZE);
     
 
@@ -168,60 +466,1007 @@ int mm_init(void) {
  */
 void *malloc (size_t size) {
     size_t asize;      /* Adjusted block size */
+    char *bp;
+    
+    /* Ignore spurious requests */
+    if (size == 0)
+       return NULL;
+
+    /* No block that big fits, and ALIGN(WSIZE + size) would wrap */
+    if (size >= HEAP_MAX) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    /* Large requests never touch the heap */
+    if (size >= mmap_threshold) {
+        HEAP_LOCK();
+        bp = map_block(size);
+        HEAP_UNLOCK();
+        return bp;
+    }
+
+    /**
+     * Adjust block size to include overhead and alignment reqs.
+     * Tiny requests are looked up in the cache by object size. Heap
+     * blocks that small are never cached, so the sizes do not collide.
+     */
+    if ( size <= SLAB_MAX_SIZE ) {
+        asize = SLAB_OBJSIZE( size );
+    } else {
+        /*add header and align, allocated blocks have no footer */
+        asize = ALIGN( WSIZE + size )  ;   
+    }
+
+    /* A recently freed block of exactly this size needs no locking */
+    if (( bp = tcache_get( asize )) != NULL ) {
+        return bp;
+    }
+
+    HEAP_LOCK();
+    if (heap_listp == 0){
+        init_heap();
+    }
+    if ( size > SLAB_MAX_SIZE ) {
+        bp = alloc_block( asize );
+    } else if ( slab_runs[SLAB_CLASS( asize )] != NULL ||
+                mem_heapsize() >= SLAB_MIN_HEAP ) {
+        bp = slab_alloc( asize );
+    } else {
+        /* A run would be a large part of so small a heap */
+        bp = alloc_block( MAX( ALIGN( WSIZE + size ), MIN_BLOCK_SIZE ));
+    }
+    HEAP_UNLOCK();
+    return bp;
+}
+
+
+/**
+ * alloc_block - Find or make room for a block of asize bytes and place it.
+ *               Caller must hold heap_lock.
+ * @param asize aligned size of the block, overhead included
+ */
+static void *alloc_block(size_t asize) {
     size_t extendsize; /* Amount to extend heap if no fit */
+    int top_free;      /* Did the heap end in a free block */
+    char *top = (char *)mem_heap_hi() + 1;   /* Block pointer of the epilogue */
+    char *bp;
+
+    /* Search the free list for a fit */
+    bp = find_fit( asize );
+    STAT_FIT( asize, bp );
+    if ( bp != NULL ) {
+        place(bp, asize);                 
+        return bp;
+    }
+    /*Still here, we need to extend the heap*/
+    top_free = !GET_PREV_ALLOC(HDRP(top));
+    extendsize = MAX( asize, grow_size );                 
+    if (( bp = extend_heap( extendsize/WSIZE )) == NULL )  
+        return NULL;                         
+    place( bp, asize );                       
+
+    /* Grow faster once several extensions in a row were used up */
+    if (top_free) {
+        grow_streak = 0;
+    } else if (++grow_streak >= GROW_STREAK) {
+        grow_streak = 0;
+        grow_size = MIN(2 * grow_size,
+                        MIN(mem_heapsize() / GROW_FRACTION, GROW_MAX));
+        grow_size = MAX(ALIGN(grow_size), CHUNKSIZE);
+    }
+    return bp;
+}
+
+
+/**
+ * free - Free a block
+ * @param bp Block to be freed
+ */
+void free(void *bp)
+{
+    if(bp == 0) 
+       return;
+    free_ptr(bp, is_slab(bp) ? RUNP(bp)->objsize : 0);
+}
+
+
+/**
+ * free_sized - Free a block, given the size it was last requested with.
+ *              Only requests of at most SLAB_MAX_SIZE bytes can be slab
+ *              objects, so larger sizes skip the slab lookup, and a slab
+ *              object's class follows from the size, so its run header
+ *              is not read. A heap block's header still is: it tells a
+ *              mapped block, and memalign and realloc leave blocks a
+ *              little larger than the size asks for.
+ * @param bp   Block to be freed
+ * @param size size passed to the malloc, calloc or realloc that made bp
+ */
+void free_sized(void *bp, size_t size)
+{
+    int slab;
+
+    if(bp == 0) 
+       return;
+    slab = size <= SLAB_MAX_SIZE && is_slab(bp);
+#ifdef DEBUG
+    check_sized(bp, size, slab);
+#endif
+    free_ptr(bp, slab ? SLAB_OBJSIZE(size) : 0);
+}
+
+
+/**
+ * free_ptr - Free a block or slab object that is not NULL
+ * @param bp      Block to be freed
+ * @param objsize object size if bp is a slab object, else 0
+ */
+static void free_ptr(void *bp, size_t objsize)
+{
+    int slab = objsize != 0;
+    size_t size;
+
+    /* A mapped block just goes away */
+    if (!slab && IS_MAPPED(HDRP(bp))) {
+        HEAP_LOCK();
+        mem_unmap(MAP_START(bp));
+        HEAP_UNLOCK();
+        return;
+    }
+
+    /* Small blocks go to this thread's cache when there is room. A heap
+       block no larger than a slab object would come back as one */
+    size = slab ? objsize : GET_SIZE(HDRP(bp));
+    if ((slab || size > SLAB_MAX_SIZE) && tcache_put(bp, size)) {
+        return;
+    }
+
+    HEAP_LOCK();
+    if (heap_listp == 0){
+       init_heap();
+    }
+    if (slab) {
+        slab_free(bp);
+    } else {
+        free_block(bp);
+    }
+    if (trim_heap(TRIM_PAD, trim_threshold)) {
+        trimmed = 1;
+    }
+    back_off();
+    HEAP_UNLOCK();
+}
+
+
+/**
+ * back_off - Halve grow_size if the heap has a large free block at the
+ *            top, since the last extensions were more than was needed.
+ *            Caller must hold heap_lock.
+ */
+static void back_off(void)
+{
+    char *top = (char *)mem_heap_hi() + 1;   /* Block pointer of the epilogue */
+
+    if (grow_size > CHUNKSIZE && !GET_PREV_ALLOC(HDRP(top)) &&
+        GET_SIZE(HDRP(PREV_BLKP(top))) >= grow_size) {
+        grow_size = MAX(ALIGN(grow_size / 2), CHUNKSIZE);
+    }
+}
+
+
+/**
+ * mm_malloc_batch - Allocate n blocks of size bytes each under a single
+ *                   lock. Heap blocks are cut back to back out of as few
+ *                   free blocks as possible.
+ * @param size requested payload size of every block
+ * @param n    number of blocks
+ * @param out  where to store the n block pointers
+ * @return the number of blocks allocated, less than n if memory ran out
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void **out)
+{
+    size_t asize;
+    size_t got = 0;
+    size_t k;
+
+    if (size == 0 || n == 0 || size >= HEAP_MAX) {
+        return 0;
+    }
+
+    HEAP_LOCK();
+    if (heap_listp == 0){
+        init_heap();
+    }
+    if (size >= mmap_threshold) {
+        while (got < n && (out[got] = map_block(size)) != NULL) {
+            got++;
+        }
+    } else if (size <= SLAB_MAX_SIZE &&
+               (slab_runs[SLAB_CLASS(SLAB_OBJSIZE(size))] != NULL ||
+                mem_heapsize() >= SLAB_MIN_HEAP)) {
+        asize = SLAB_OBJSIZE(size);
+        while (got < n && (out[got] = slab_alloc(asize)) != NULL) {
+            got++;
+        }
+    } else {
+        /* Tiny sizes get ordinary blocks too while the heap is small */
+        asize = MAX(ALIGN(WSIZE + size), MIN_BLOCK_SIZE);
+        while (got < n && (k = carve_batch(asize, n - got, out + got)) > 0) {
+            got += k;
+        }
+    }
+    HEAP_UNLOCK();
+    return got;
+}
+
+
+/**
+ * carve_batch - Cut up to n blocks of asize bytes out of one free block:
+ *               one that holds them all if there is one, else any that
+ *               holds at least one, else a new one at the top of the heap.
+ *               While asize's own seg list has free blocks, it takes one
+ *               block at a time from there instead, as malloc would:
+ *               carving the whole batch out of a larger block would split
+ *               it and leave those holes unused.
+ *               Caller must hold heap_lock.
+ * @param asize aligned size of every block, overhead included
+ * @param n     number of blocks wanted
+ * @param out   where to store the block pointers
+ * @return the number of blocks cut, 0 if the heap cannot grow
+ */
+static size_t carve_batch(size_t asize, size_t n, void **out)
+{
+    size_t k = MAX(MIN(n, BATCH_MAX_BYTES / asize), 1);
+    size_t csize, size;
+    char *bp;
+    size_t i;
+
+    if (seg_bitmap & (1u << get_list_index(asize))) {
+        k = 1;
+    }
+    bp = find_fit(k * asize);
+    STAT_FIT(k * asize, bp);
+    if (bp == NULL && k > 1 && (bp = find_fit(asize)) != NULL) {
+        STAT_FIT(asize, bp);
+        k = MIN(k, GET_SIZE(HDRP(bp)) / asize);
+    }
+    if (bp == NULL &&
+        (bp = extend_heap(MAX(k * asize, grow_size) / WSIZE)) == NULL) {
+        return 0;
+    }
+    place(bp, k * asize);
+
+    /* Split the block place() allocated into k, the last one keeping
+       any slack too small to be a free block */
+    csize = GET_SIZE(HDRP(bp));
+    for (i = 0; i < k; i++) {
+        size = (i == k - 1) ? csize - i * asize : asize;
+        PUT(HDRP(bp), PACK(size, (i == 0 ? GET_PREV_ALLOC(HDRP(bp)) :
+                                           PREV_ALLOC) | 1));
+        out[i] = bp;
+        bp += size;
+    }
+    return k;
+}
+
+
+/**
+ * mm_free_batch - Free n blocks under a single lock. The heap blocks are
+ *                 sorted by address first, so that every run of adjacent
+ *                 blocks is freed and coalesced as one block. ptrs is
+ *                 used as scratch space, so its contents are lost.
+ * @param ptrs blocks to free, NULL entries are skipped
+ * @param n    number of entries in ptrs
+ */
+void mm_free_batch(void **ptrs, size_t n)
+{
+    size_t i, j;
+    size_t m = 0;
+    size_t size;
+    char *bp;
+
+    HEAP_LOCK();
+    if (heap_listp == 0){
+        init_heap();
+    }
+
+    /* Slab objects and mapped blocks go right away, heap blocks are
+       gathered at the front of ptrs */
+    for (i = 0; i < n; i++) {
+        if ((bp = ptrs[i]) == NULL) {
+            continue;
+        }
+        if (is_slab(bp)) {
+            slab_free(bp);
+        } else if (IS_MAPPED(HDRP(bp))) {
+            mem_unmap(MAP_START(bp));
+        } else {
+            ptrs[m++] = bp;
+        }
+    }
+    sort_blocks(ptrs, m);
+
+    for (i = 0; i < m; i = j) {
+        bp = ptrs[i];
+        size = GET_SIZE(HDRP(bp));
+        for (j = i + 1; j < m && (char *)ptrs[j] == bp + size; j++) {
+            size += GET_SIZE(HDRP(ptrs[j]));
+        }
+        PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp)) | 1));
+        free_block(bp);
+    }
+
+    if (trim_heap(TRIM_PAD, trim_threshold)) {
+        trimmed = 1;
+    }
+    back_off();
+    HEAP_UNLOCK();
+}
+
+
+/**
+ * sort_blocks - Sort block pointers by address in place. It is a
+ *               heapsort, as qsort may call malloc.
+ * @param v array of pointers
+ * @param n number of pointers
+ */
+static void sort_blocks(void **v, size_t n)
+{
+    size_t i;
+    void *t;
+
+    for (i = n / 2; i-- > 0; ) {
+        sift_down(v, i, n);
+    }
+    for (i = n; i-- > 1; ) {
+        t = v[0];
+        v[0] = v[i];
+        v[i] = t;
+        sift_down(v, 0, i);
+    }
+}
+
+
+/**
+ * sift_down - Move v[root] down the max-heap v[0..n) to its place
+ */
+static void sift_down(void **v, size_t root, size_t n)
+{
+    void *t = v[root];
+    size_t child;
+
+    while ((child = 2 * root + 1) < n) {
+        if (child + 1 < n && (char *)v[child + 1] > (char *)v[child]) {
+            child++;
+        }
+        if ((char *)v[child] <= (char *)t) {
+            break;
+        }
+        v[root] = v[child];
+        root = child;
+    }
+    v[root] = t;
+}
+
+
+/**
+ * mm_set_mmap_threshold - Set the request size from which blocks get a
+ *                         mapping of their own instead of heap space
+ * @param threshold request size in bytes, 0 restores the default
+ */
+void mm_set_mmap_threshold(size_t threshold)
+{
+    mmap_threshold = threshold ? threshold : MMAP_THRESHOLD;
+}
+
+
+/**
+ * mm_heap_info - Measure the free space in every seg list and slab class
+ * @param info where to store the snapshot
+ */
+void mm_heap_info(mm_heap_info_t *info)
+{
+    char *bp;
+    size_t size;
+
+    memset(info, 0, sizeof(*info));
+    HEAP_LOCK();
+    info->heap_bytes = mem_heapsize() + mem_mapsize();
+    for (int i = 0; i < TREE_INDEX; i++) {
+        for (bp = SEGBLKP(free_listp, i); bp != NULL; bp = NEXT_SEGBLKP(bp)) {
+            size = GET_SIZE(HDRP(bp));
+            info->free_bytes[i] += size;
+            info->largest_free = MAX(info->largest_free, size);
+        }
+    }
+    bp = SEGBLKP(free_listp, TREE_INDEX);
+    info->free_bytes[TREE_INDEX] = tree_bytes(bp);
+    if (bp != NULL) {
+        /* The rightmost block of the tree is its largest */
+        while (RIGHT_CHILD(bp) != NULL) {
+            bp = RIGHT_CHILD(bp);
+        }
+        info->largest_free = MAX(info->largest_free, GET_SIZE(HDRP(bp)));
+    }
+    for (int c = 0; c < SLAB_CLASSES; c++) {
+        for (slab_run_t *run = slab_runs[c]; run != NULL; run = run->next) {
+            info->slab_free_bytes +=
+                (size_t)__builtin_popcountl(run->freemap) * run->objsize;
+        }
+    }
+    HEAP_UNLOCK();
+}
+
+
+/**
+ * tree_bytes - Sum the sizes of the blocks in a subtree.
+ *              Caller must hold heap_lock.
+ * @param t Root of the subtree
+ * @return  bytes in its blocks
+ */
+static size_t tree_bytes(char *t)
+{
+    if (t == NULL) {
+        return 0;
+    }
+    return GET_SIZE(HDRP(t)) + tree_bytes(LEFT_CHILD(t)) +
+        tree_bytes(RIGHT_CHILD(t));
+}
+
+
+#ifdef MM_STATS
+/**
+ * mm_get_stats - Copy out the counters gathered since the last mm_init
+ * @param st where to store them
+ */
+void mm_get_stats(mm_stats_t *st)
+{
+    HEAP_LOCK();
+    *st = stats;
+    HEAP_UNLOCK();
+}
+
+
+/**
+ * stat_fit - Count a find_fit call: how many blocks it visited, and
+ *            whether it found a block in the class of asize itself.
+ *            Caller must hold heap_lock.
+ * @param asize size that was searched for
+ * @param bp    block find_fit returned, or NULL
+ */
+static void stat_fit(size_t asize, void *bp)
+{
+    unsigned int index = get_list_index(asize);
+    unsigned int bucket = 0;
+
+    if (fit_probes != 0) {
+        bucket = sizeof(unsigned long) * CHAR_BIT - __builtin_clzl(fit_probes);
+        bucket = MIN(bucket, MM_STATS_PROBES - 1);
+    }
+    STAT_INC(probes[bucket]);
+
+    if (bp == NULL) {
+        STAT_INC(class_misses[index]);
+    } else if (get_list_index(GET_SIZE(HDRP(bp))) == index) {
+        STAT_INC(class_hits[index]);
+    } else {
+        STAT_INC(class_spills[index]);
+    }
+}
+#endif
+
+
+/**
+ * map_block - Allocate a block of size bytes in a mapping of its own.
+ *             Caller must hold heap_lock, memlib is not thread-safe.
+ * @param size requested payload size
+ */
+static void *map_block(size_t size)
+{
+    size_t pagesize = mem_pagesize();
+    size_t len;
+    char *p;
+
+    /* The length has to fit in the size field of the header, and the
+       rounding must not wrap first */
+    if (size > UINT_MAX - DSIZE - pagesize) {
+        return NULL;
+    }
+    len = (size + DSIZE + pagesize - 1) & ~(pagesize - 1);
+    if (len > (UINT_MAX & ~0x7) || (p = mem_map(len)) == (void *)-1) {
+        return NULL;
+    }
+    PUT(p + WSIZE, PACK(len, MAPPED | 1));
+    return p + DSIZE;
+}
+
+
+/**
+ * remap_block - Resize a mapped block to size bytes, moving it without
+ *               a copy if the mapping cannot grow in place.
+ *               Caller must hold heap_lock.
+ * @param bp   Mapped block
+ * @param size new payload size
+ * @return the block, or NULL with bp left untouched
+ */
+static void *remap_block(void *bp, size_t size)
+{
+    size_t pagesize = mem_pagesize();
+    size_t len;
+    char *p;
+
+    if (size > UINT_MAX - DSIZE - pagesize) {
+        return NULL;
+    }
+    len = (size + DSIZE + pagesize - 1) & ~(pagesize - 1);
+    if (len == GET_SIZE(HDRP(bp))) {
+        return bp;
+    }
+    if (len > (UINT_MAX & ~0x7) ||
+        (p = mem_remap(MAP_START(bp), len)) == (void *)-1) {
+        return NULL;
+    }
+    PUT(p + WSIZE, PACK(len, MAPPED | 1));
+    return p + DSIZE;
+}
+
+
+/**
+ * mm_trim - Give unused memory back: shrink the heap down to pad bytes
+ *           of free space at the top, and release the pages inside the
+ *           other free blocks of at least RELEASE_MIN bytes. Smaller
+ *           ones are left alone, as they are likely reused soon and
+ *           hold few whole pages.
+ * @param pad Bytes of free space to keep at the top of the heap
+ * @return    the number of bytes released
+ */
+size_t mm_trim(size_t pad)
+{
+    char *bp;
+    size_t released = 0;
+
+    HEAP_LOCK();
+    if (heap_listp == 0) {
+        HEAP_UNLOCK();
+        return 0;
+    }
+    released = trim_heap(pad, 0);
+
+    /* Keep the links at the start and the footer at the end */
+    for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+        if (!GET_ALLOC(HDRP(bp)) && GET_SIZE(HDRP(bp)) >= RELEASE_MIN) {
+            released += mem_release(bp + DSIZE,
+                                    GET_SIZE(HDRP(bp)) - 2*DSIZE);
+        }
+    }
+    HEAP_UNLOCK();
+    return released;
+}
+
+
+/**
+ * free_block - Mark a block free, coalesce it and put it on its seg list.
+ *              Caller must hold heap_lock.
+ * @param bp Block to be freed
+ */
+static void free_block(void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
+    PUT(FTRP(bp), PACK(size, 0));
+    CLR_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+    
+    /*Coalesce the block*/
+    bp = mm_coalesce(bp);
+    
+    bp = list_add(bp);
+}
+
+
+/**
+ * trim_heap - Shrink the free block at the top of the heap to pad bytes
+ *             and give the rest back to memlib, if that frees at least
+ *             min bytes. Caller must hold heap_lock.
+ * @param pad Bytes of the top block to keep
+ * @param min Least number of bytes worth giving back
+ * @return the number of bytes given back, 0 if the heap did not shrink
+ */
+static size_t trim_heap(size_t pad, size_t min)
+{
+    char *top = (char *)mem_heap_hi() + 1;   /* Block pointer of the epilogue */
+    char *bp;
+    size_t size;
+    size_t keep = ALIGN(pad);
+
+    if (GET_PREV_ALLOC(HDRP(top))) {
+        return 0;
+    }
+    bp = PREV_BLKP(top);
+    size = GET_SIZE(HDRP(bp));
+    if (keep != 0 && keep < MIN_BLOCK_SIZE) {
+        keep = MIN_BLOCK_SIZE;
+    }
+    if (keep >= size || size - keep < MAX(min, 1)) {
+        return 0;
+    }
+
+    list_delete(bp);
+    if (keep == 0) {
+        /* The whole block goes, its header becomes the epilogue */
+        PUT(HDRP(bp), PACK(0, GET_PREV_ALLOC(HDRP(bp)) | 1));
+    } else {
+        PUT(HDRP(bp), PACK(keep, GET_PREV_ALLOC(HDRP(bp))));
+        PUT(FTRP(bp), PACK(keep, 0));
+        PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));   /* New epilogue header */
+        list_add(bp);
+    }
+    mem_sbrk(-(int)(size - keep));
+    return size - keep;
+}
+
+
+/**
+ * alloc_aligned - Allocate a block of asize bytes whose payload is aligned
+ *                 to align bytes. The fragments before and after the
+ *                 aligned block are given back to the free lists.
+ *                 Caller must hold heap_lock.
+ * @param asize aligned size of the block, overhead included
+ * @param align alignment of the payload, a power of two
+ */
+static void *alloc_aligned(size_t asize, size_t align)
+{
+    char *bp;
+    char *abp;
+    size_t csize;
+    size_t lead;
+
+    if ((bp = find_fit_aligned(asize, align)) == NULL &&
+        (bp = extend_aligned(asize, align)) == NULL) {
+        return NULL;
+    }
+    place(bp, GET_SIZE(HDRP(bp)));
+
+    abp = ALIGNED_BLKP(bp, align);
+    if (abp == bp) {
+        shrink_block(bp, asize);
+        return bp;
+    }
+    csize = GET_SIZE(HDRP(bp));
+    lead = abp - bp;
+
+    /* Split off the leading fragment and free it */
+    PUT(HDRP(bp), PACK(lead, GET_PREV_ALLOC(HDRP(bp)) | 1));
+    PUT(HDRP(abp), PACK(csize - lead, 1));
+    free_block(bp);
+
+    shrink_block(abp, asize);
+    return abp;
+}
+
+
+/**
+ * extend_aligned - Extend the heap just enough for the free block at the
+ *                  top to hold an aligned block of asize bytes.
+ *                  Caller must hold heap_lock.
+ * @param asize aligned size of the block, overhead included
+ * @param align alignment of the payload, a power of two
+ * @return the free block at the top of the heap
+ */
+static void *extend_aligned(size_t asize, size_t align)
+{
+    char *top = (char *)mem_heap_hi() + 1;   /* Block pointer of the epilogue */
+    char *bp = top;
+    size_t need;
+
+    if (!GET_PREV_ALLOC(HDRP(top))) {
+        bp = PREV_BLKP(top);
+        if (ALIGNED_BLKP(bp, align) + asize <= top) {
+            return bp;
+        }
+    }
+    need = ALIGNED_BLKP(bp, align) + asize - top;
+    return extend_heap(MAX(need, MIN_BLOCK_SIZE) / WSIZE);
+}
+
+
+/**
+ * shrink_block - Cut an allocated block down to asize bytes, freeing the
+ *                tail if it is large enough to be a block of its own.
+ *                Caller must hold heap_lock.
+ * @param bp    Allocated block
+ * @param asize aligned size to keep, overhead included
+ */
+static void shrink_block(void *bp, size_t asize)
+{
+    size_t csize = GET_SIZE(HDRP(bp));
+    char *tail;
+
+    if ((csize - asize) < MIN_BLOCK_SIZE) {
+        return;
+    }
+    PUT(HDRP(bp), PACK(asize, GET_PREV_ALLOC(HDRP(bp)) | 1));
+    tail = NEXT_BLKP(bp);
+    PUT(HDRP(tail), PACK(csize - asize, PREV_ALLOC | 1));
+    free_block(tail);
+}
+
+
+/**
+ * resize_block - Resize an allocated block to asize bytes without moving
+ *                it, by splitting off its tail, absorbing the free block
+ *                after it or extending the heap when it is the last block.
+ *                Caller must hold heap_lock.
+ * @param bp    Allocated block
+ * @param asize aligned size of the block, overhead included
+ * @return bp, or NULL if the block has to move
+ */
+static void *resize_block(void *bp, size_t asize)
+{
+    size_t csize = GET_SIZE(HDRP(bp));
+    char *next = NEXT_BLKP(bp);
+    size_t avail = csize;
+
+    if (asize <= csize) {
+        shrink_block(bp, asize);
+        return bp;
+    }
+
+    if (!GET_ALLOC(HDRP(next))) {
+        avail += GET_SIZE(HDRP(next));
+    }
+    if (avail < asize) {
+        /* Only the last block can grow past its neighbour */
+        if (GET_SIZE(HDRP(next)) != 0 &&
+            (GET_ALLOC(HDRP(next)) || GET_SIZE(HDRP(NEXT_BLKP(next))) != 0)) {
+            return NULL;
+        }
+        if (extend_heap(MAX(asize - avail, MIN_BLOCK_SIZE) / WSIZE) == NULL) {
+            return NULL;
+        }
+    }
+
+    /* Absorb the free block that now follows bp */
+    next = NEXT_BLKP(bp);
+    list_delete(next);
+    csize += GET_SIZE(HDRP(next));
+    zero_lo = MAX(zero_lo, (char *)bp + csize);
+    PUT(HDRP(bp), PACK(csize, GET_PREV_ALLOC(HDRP(bp)) | 1));
+    SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+
+    shrink_block(bp, asize);
+    return bp;
+}
+
+
+/**
+ * is_slab - Check whether an allocated pointer is a slab object
+ * @param bp Pointer returned by malloc
+ * @return   1 if bp lies in a slab run, 0 if it is a regular block
+ */
+static inline int is_slab(const void *bp)
+{
+    size_t index = RUN_INDEX(bp);
+
+    /* Mapped blocks lie outside the heap, below or above it */
+    if (index / CHAR_BIT >= slab_map_len) {
+        return 0;
+    }
+    return (slab_map[index / CHAR_BIT] >> (index % CHAR_BIT)) & 1;
+}
+
+
+/**
+ * slab_alloc - Hand out a free object of objsize bytes, carving a new run
+ *              out of the heap if every run of that class is full.
+ *              Caller must hold heap_lock.
+ * @param objsize object size, a multiple of DSIZE up to SLAB_MAX_SIZE
+ */
+static void *slab_alloc(size_t objsize)
+{
+    unsigned int cls = SLAB_CLASS(objsize);
+    slab_run_t *run = slab_runs[cls];
+    size_t index;
+    int i;
+
+    if (run == NULL) {
+        /* Runs tile the heap back to back: the next run's header sits
+           right after this run's footer */
+        if ((run = alloc_aligned(RUN_SIZE, RUN_SIZE)) == NULL) {
+            return NULL;
+        }
+        run->objsize = objsize;
+        run->nobjs = MIN(RUN_OBJ_BYTES / objsize,
+                         sizeof(run->freemap) * CHAR_BIT);
+        run->freemap = ~0UL >> (sizeof(run->freemap) * CHAR_BIT - run->nobjs);
+        run->prev = NULL;
+        run->next = NULL;
+        slab_runs[cls] = run;
+
+        index = RUN_INDEX(run);
+        slab_map[index / CHAR_BIT] |= 1 << (index % CHAR_BIT);
+        slab_map_len = MAX(slab_map_len, index / CHAR_BIT + 1);
+    }
+
+    /* Take the lowest free object; a full run leaves the list */
+    i = __builtin_ctzl(run->freemap);
+    run->freemap &= run->freemap - 1;
+    if (run->freemap == 0) {
+        slab_runs[cls] = run->next;
+        if (run->next != NULL) {
+            run->next->prev = NULL;
+        }
+    }
+    return (char *)run + RUN_HDR_SIZE + i * objsize;
+}
+
+
+/**
+ * slab_free - Return an object to its run. A run that becomes empty goes
+ *             back to the heap, unless it is the last run of its class
+ *             with free objects. Caller must hold heap_lock.
+ * @param bp Object to be freed
+ */
+static void slab_free(void *bp)
+{
+    slab_run_t *run = RUNP(bp);
+    unsigned int cls = SLAB_CLASS(run->objsize);
+    unsigned long all = ~0UL >> (sizeof(run->freemap) * CHAR_BIT - run->nobjs);
+    size_t index;
+
+    if (run->freemap == 0) {
+        /* The run was full: it has a free object again */
+        run->prev = NULL;
+        run->next = slab_runs[cls];
+        if (run->next != NULL) {
+            run->next->prev = run;
+        }
+        slab_runs[cls] = run;
+    }
+    run->freemap |= 1UL << (((char *)bp - (char *)run - RUN_HDR_SIZE)
+                            / run->objsize);
+
+    if (run->freemap == all && (run->prev != NULL || run->next != NULL)) {
+        if (run->prev != NULL) {
+            run->prev->next = run->next;
+        } else {
+            slab_runs[cls] = run->next;
+        }
+        if (run->next != NULL) {
+            run->next->prev = run->prev;
+        }
+        index = RUN_INDEX(run);
+        slab_map[index / CHAR_BIT] &= ~(1 << (index % CHAR_BIT));
+        free_block(run);
+    }
+}
+
+
+#ifdef THREAD_SAFE
+/**
+ * tcache_flush - Return every block in the calling thread's cache to the
+ *                heap. Runs as the tcache_key destructor at thread exit.
+ * @param arg the exiting thread's cache
+ */
+static void tcache_flush(void *arg)
+{
+    tcache_t *tc = arg;
+    char *bp;
+
+    HEAP_LOCK();
+    if (tc->gen == heap_gen) {
+        for (int i = 0; i < TCACHE_BINS; i++) {
+            while ((bp = tc->bins[i]) != NULL) {
+                tc->bins[i] = TCACHE_NEXT(bp);
+                if (is_slab(bp)) {
+                    slab_free(bp);
+                } else {
+                    free_block(bp);
+                }
+            }
+        }
+    }
+    HEAP_UNLOCK();
+    memset(tc, 0, sizeof(*tc));
+}
+
+
+static void tcache_key_init(void)
+{
+    pthread_key_create(&tcache_key, tcache_flush);
+}
+
+
+/*
+ * A fork copies heap_lock as it is, so the child of a fork made while
+ * another thread held it would wait on it forever. The forking thread
+ * takes the lock across the fork instead, and both sides release it.
+ */
+static void fork_prepare(void)
+{
+    HEAP_LOCK();
+}
+
+
+static void fork_release(void)
+{
+    HEAP_UNLOCK();
+}
+
+
+__attribute__((constructor))
+static void fork_handlers_init(void)
+{
+    pthread_atfork(fork_prepare, fork_release, fork_release);
+}
+
+
+/**
+ * tcache_sync - Drop the cached blocks if mm_init has reset the heap
+ *               since they were cached.
+ * @return 1 if the cache is usable, 0 if it has not been set up yet
+ */
+static inline int tcache_sync(void)
+{
+    unsigned long gen = __atomic_load_n(&heap_gen, __ATOMIC_ACQUIRE);
+
+    if (tcache.gen != gen) {
+        memset(&tcache, 0, sizeof(tcache));
+        tcache.gen = gen;
+        return 0;
+    }
+    return 1;
+}
+
+
+/**
+ * tcache_get - Pop a cached block of exactly asize bytes
+ * @param asize aligned size of the block, overhead included
+ * @return the block, or NULL on a miss
+ */
+static void *tcache_get(size_t asize)
+{
     char *bp;
-    
-    if (heap_listp == 0){
-        mm_init();
-    }
-    /* Ignore spurious requests */
-    if (size == 0)
-       return NULL;
+    size_t bin = asize / DSIZE;
 
-    /* Adjust block size to include overhead and alignment reqs. */
-    if ( size <= DSIZE ) { 
-        asize = 3*DSIZE;
-    } else {
-        /*add overhead and align */
-        asize = ALIGN( DSIZE + size )  ;   
+    if (asize > TCACHE_MAX_SIZE || !tcache_sync()) {
+        return NULL;
     }
-    /* Search the free list for a fit */
-    if (( bp = find_fit( asize )) != NULL ) {
-        place(bp, asize);                 
-        return bp;
+    if ((bp = tcache.bins[bin]) != NULL) {
+        tcache.bins[bin] = TCACHE_NEXT(bp);
+        tcache.counts[bin]--;
     }
-    /*Still here, we need to extend the heap*/
-    extendsize = MAX( asize, CHUNKSIZE );                 
-    if (( bp = extend_heap( extendsize/WSIZE )) == NULL )  
-        return NULL;                         
-    place( bp, asize );                       
     return bp;
 }
 
 
 /**
- * mm_free - Free a block
- * @param bp Block to be freed
+ * tcache_put - Keep a freed block in the calling thread's cache
+ * @param bp   Block being freed
+ * @param size its block size, or object size for a slab object
+ * @return 1 if the block was cached, 0 if it must go back to the heap
  */
-void mm_free(void *bp)
+static int tcache_put(void *bp, size_t size)
 {
-    if(bp == 0) 
-       return;
-    
-    size_t size = GET_SIZE(HDRP(bp));
-    if (heap_listp == 0){
-       mm_init();
+    size_t bin = size / DSIZE;
+
+    if (size > TCACHE_MAX_SIZE) {
+        return 0;
     }
-    
-    PUT(HDRP(bp), PACK(size, 0));
-    PUT(FTRP(bp), PACK(size, 0));
-    
-    
-    /*Coalesce the block*/
-    bp = mm_coalesce(bp);
-    
-    bp = list_add(bp);
+    if (!tcache_sync()) {
+        /* First use by this thread: arrange for a flush at thread exit */
+        pthread_once(&tcache_once, tcache_key_init);
+        pthread_setspecific(tcache_key, &tcache);
+    }
+    if (tcache.counts[bin] >= TCACHE_FILL) {
+        return 0;
+    }
+    TCACHE_NEXT(bp) = tcache.bins[bin];
+    tcache.bins[bin] = bp;
+    tcache.counts[bin]++;
+    return 1;
 }
+#endif
 
 
 /**
@@ -231,7 +1476,7 @@ void mm_free(void *bp)
  */
 static inline void *mm_coalesce(void *bp)
 {   
-    size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
     size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
     size_t size = GET_SIZE(HDRP(bp));
     
@@ -241,41 +1486,49 @@ static inline void *mm_coalesce(void *bp)
     }
 
     if (prev_alloc && next_alloc) {               /* Case 1 */
+        STAT_INC(coalesce[0]);
         return bp;               
     }
     
     else if (prev_alloc && !next_alloc) {       /* Case 2 */
+        STAT_INC(coalesce[1]);
         /* The next block will be coalesced into bp block, 
          then delete it from list */
         list_delete(NEXT_BLKP(bp));
+        zero_lo = MAX(zero_lo, NEXT_BLKP(bp) + 2*WSIZE);
         
         size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
-        PUT(HDRP(bp), PACK(size, 0));
+        PUT(HDRP(bp), PACK(size, prev_alloc));
         PUT(FTRP(bp), PACK(size, 0));
     }
     
     else if (!prev_alloc && next_alloc ) {       /* Case 3 */
+        STAT_INC(coalesce[2]);
         /* The previous block will be coalesced into bp block, 
          then delete it from list */
         list_delete(PREV_BLKP(bp));
         
         size += GET_SIZE(HDRP(PREV_BLKP(bp)));
         PUT(FTRP(bp), PACK(size, 0));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
+        PUT(HDRP(PREV_BLKP(bp)), PACK(size,
+            GET_PREV_ALLOC(HDRP(PREV_BLKP(bp)))));
         bp = PREV_BLKP(bp);
 
     }
     
     else {                                        /* Case 4 */
+        STAT_INC(coalesce[3]);
         /* Remove both previous and next block from thel list */
         list_delete(PREV_BLKP(bp));
         list_delete(NEXT_BLKP(bp));
+        zero_lo = MAX(zero_lo, NEXT_BLKP(bp) + 2*WSIZE);
         
         /* Both Previous and Next Block are not allocated */
         size += GET_SIZE(HDRP(PREV_BLKP(bp))) +
-        GET_SIZE(FTRP(NEXT_BLKP(bp)));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
-        PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
+        GET_SIZE(HDRP(NEXT_BLKP(bp)));
+        PUT(HDRP(PREV_BLKP(bp)), PACK(size,
+            GET_PREV_ALLOC(HDRP(PREV_BLKP(bp)))));
+        PUT(FTRP(PREV_BLKP(bp)), PACK(size, 0));
         bp = PREV_BLKP(bp);
     }
     
@@ -291,14 +1544,28 @@ static inline void *extend_heap(size_t words)
 {
     char *bp;
     size_t size;
+    char *fresh = mem_zero_lo();
+
+    /* Growing right after a trim: trim less eagerly from now on */
+    if (trimmed) {
+        trim_threshold = MIN(2 * trim_threshold, TRIM_THRESHOLD_MAX);
+        trimmed = 0;
+    }
 
     /* Allocate an even number of words to maintain alignment */
     size = (words % 2) ? (words+1) * WSIZE : words * WSIZE; 
     if ((long)(bp = mem_sbrk(size)) == -1)  
         return NULL;                                        
+    STAT_INC(extend_calls);
+    STAT_ADD(extend_bytes, size);
 
-    /* Initialize free block header/footer and the epilogue header */
-    PUT( HDRP( bp ), PACK( size, 0 ));         /* Free block header */
+    /* What memlib never handed out before is zero. Below it the old top
+       block may hold stale headers and footers once they coalesce */
+    zero_lo = MIN(fresh, bp + size);
+
+    /* Initialize free block header/footer and the epilogue header.
+       The old epilogue header knows whether the last block is allocated */
+    PUT( HDRP( bp ), PACK( size, GET_PREV_ALLOC( HDRP( bp ))));  /* Free block header */
     PUT( FTRP( bp ), PACK( size, 0 ));         /* Free block footer */
     PUT( HDRP( NEXT_BLKP( bp )), PACK(0, 1)); /* New epilogue header */
     
@@ -319,25 +1586,22 @@ static inline void *extend_heap(size_t words)
  */
 static inline void place(void *bp, size_t asize)
 {
-    int prev_alloc=0;
-    int next_alloc=0;
+    size_t prev_alloc;
     size_t csize = GET_SIZE(HDRP(bp));
     
     list_delete(bp);
     
-    prev_alloc = PREV_ALLOC(PREV_BLKP(bp));
-    next_alloc = NEXT_ALLOC(NEXT_BLKP(bp));
+    prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    placed_zero = MAX((char *)bp, zero_lo);
     
     if ((csize - asize) >= MIN_BLOCK_SIZE) { 
+        zero_lo = MAX(zero_lo, (char *)bp + asize);
         /* Splice the etc free space */
-        /* Put allocation in header, for next, previous, current
-         * Bit wise or of the values, is put 
-         */
-        PUT(HDRP(bp), PACK(asize, (next_alloc| prev_alloc| 1)));
-        PUT(FTRP(bp), PACK(asize, (next_alloc| prev_alloc| 1)));
+        /* Allocated block gets a header only, keeping its prev bit */
+        PUT(HDRP(bp), PACK(asize, (prev_alloc| 1)));
         /* Splice the Next Block */
         bp = NEXT_BLKP(bp);
-        PUT(HDRP(bp), PACK(csize-asize, 0));
+        PUT(HDRP(bp), PACK(csize-asize, PREV_ALLOC));
         PUT(FTRP(bp), PACK(csize-asize, 0));
         
         /*Coalesce the block*/
@@ -346,9 +1610,10 @@ static inline void place(void *bp, size_t asize)
         /*Add the newly spliced block to free list*/
         bp = list_add(bp);
     } else {
-        /* Do the allocation directly */
-        PUT(HDRP(bp), PACK(csize, (next_alloc| prev_alloc| 1)));
-        PUT(FTRP(bp), PACK(csize, (next_alloc| prev_alloc| 1)));
+        zero_lo = MAX(zero_lo, (char *)bp + csize);
+        /* Do the allocation directly, and tell the next block */
+        PUT(HDRP(bp), PACK(csize, (prev_alloc| 1)));
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
     }
 }
 
@@ -362,17 +1627,106 @@ static inline void *find_fit (size_t asize)
 {
     void *bp = 0; 
     unsigned int index = get_list_index(asize);
+    unsigned int larger;
+
+#ifdef MM_STATS
+    fit_probes = 0;
+#endif
+    if (index == TREE_INDEX) {
+        return tree_fit(asize);
+    }
     
-    /* index is the minimum list it should start to search for*/
-    for (int i = index; i < LISTSIZE; i++) {
-        for (bp = SEGBLKP(free_listp, i); (bp!=NULL) && GET_SIZE(HDRP(bp)) > 0;
-         bp = NEXT_SEGBLKP(bp)) {
-            if ( bp!=NULL && (asize <= GET_SIZE(HDRP(bp)))) {
+    /* Blocks in the list for asize itself may still be too small */
+    for (bp = SEGBLKP(free_listp, index); bp != NULL; bp = NEXT_SEGBLKP(bp)) {
+        STAT_PROBE();
+        if (asize <= GET_SIZE(HDRP(bp))) {
+            return bp;
+        }
+    }
+
+    /**
+     * Every block in a higher list is larger than asize, so the head of
+     * the first non-empty one is the first fit.
+     */
+    larger = seg_bitmap & ~((2u << index) - 1);
+    if (larger == 0) {
+        return NULL; /* No fit */
+    }
+    index = __builtin_ctz(larger);
+    if (index == TREE_INDEX) {
+        return tree_fit(asize);
+    }
+    STAT_PROBE();
+    return SEGBLKP(free_listp, index);
+}
+
+
+/**
+ * find_fit_aligned - Find a free block that holds a block of asize bytes
+ *                    at an align-aligned payload address
+ * @param asize aligned size of the block, overhead included
+ * @param align alignment of the payload, a power of two
+ */
+static void *find_fit_aligned(size_t asize, size_t align)
+{
+    void *bp;
+    unsigned int lists = seg_bitmap & ~((1u << get_list_index(asize)) - 1);
+
+    for (lists &= ~(1u << TREE_INDEX); lists != 0; lists &= lists - 1) {
+        for (bp = SEGBLKP(free_listp, __builtin_ctz(lists)); bp != NULL;
+             bp = NEXT_SEGBLKP(bp)) {
+            if (ALIGNED_BLKP(bp, align) + asize <= NEXT_BLKP(bp)) {
                 return bp;
             }
-        }    
+        }
+    }
+
+    /* Try the best fit, then the smallest block that always fits */
+    if ((bp = tree_fit(asize)) != NULL &&
+        ALIGNED_BLKP(bp, align) + asize <= NEXT_BLKP(bp)) {
+        return bp;
+    }
+    return tree_fit(asize + MIN_BLOCK_SIZE + align - DSIZE);
+}
+
+
+/**
+ * check_sized - Check the size given to free_sized against the block: a
+ *               slab object must be of that size's class, a heap block
+ *               at least that size and short of it by less than one
+ *               split (blocks from memalign are never under 72 bytes),
+ *               and a mapped block less than a page larger
+ * @param bp   Block about to be freed
+ * @param size size passed to free_sized
+ * @param slab whether bp is a slab object
+ */
+static void check_sized(void *bp, size_t size, int slab)
+{
+    size_t asize = MAX(ALIGN(WSIZE + size), MIN_BLOCK_SIZE);
+    size_t bsize;
+
+    if (slab) {
+        if (RUNP(bp)->objsize != SLAB_OBJSIZE(size)) {
+            printf("ERROR: free_sized(%p, %zu) of a %u-byte slab object\n",
+                   bp, size, RUNP(bp)->objsize);
+        }
+        return;
+    }
+    bsize = usable_size(bp);
+    if (IS_MAPPED(HDRP(bp))) {
+        if (size > bsize || bsize - size >= mem_pagesize()) {
+            printf("ERROR: free_sized(%p, %zu) of a %zu-byte mapping\n",
+                   bp, size, bsize);
+        }
+        return;
+    }
+    bsize = GET_SIZE(HDRP(bp));
+    if (bsize < asize ||
+        bsize >= MAX(asize, ALIGN(WSIZE + SLAB_MAX_SIZE + 1)) +
+                 MIN_BLOCK_SIZE) {
+        printf("ERROR: free_sized(%p, %zu) of a %zu-byte block\n",
+               bp, size, bsize);
     }
-    return NULL; /* No fit */
 }
 
 
@@ -395,8 +1749,9 @@ static void checkblock(void *bp)
        printf("ERROR: %p is not doubleword aligned\n", bp);
     }
 
-    /*Check Block Header matching Footer*/
-    if (GET(HDRP(bp)) != GET(FTRP(bp))) {
+    /*Check free Block Header matching Footer*/
+    if (!GET_ALLOC(HDRP(bp)) &&
+        GET_SIZE(HDRP(bp)) != GET_SIZE(FTRP(bp))) {
         printf("ERROR: header does not match footer\n");
         dbg_printf("**Debug Info \n");
         dbg_printf("Heap_listp = %p \n", heap_listp );
@@ -414,7 +1769,7 @@ static void checkblock(void *bp)
      *           checks.
      */    
     /* Check Coalescing with Next Block */
-    if( GET_ALLOC(HDRP(bp)) ==0 && NEXT_BLKP(bp)!=NULL 
+    if( GET_ALLOC(HDRP(bp)) ==0
         && GET_ALLOC(HDRP(NEXT_BLKP(bp))) ==0 ) {
         printf("ERROR: %p is not coalesced with next block\n", bp);        
         exit(1);
@@ -436,7 +1791,7 @@ static void check_seg_pointers()
     size_t asize;
 
     /* Check for all the pointers in the blocks to be correct */
-    for (int i = 0; i < LISTSIZE; i++) {
+    for (int i = 0; i < TREE_INDEX; i++) {
         for (bp = SEGBLKP(free_listp,i); (bp!=NULL)
           &&  (GET_SIZE(HDRP(bp)) > 0);bp = NEXT_SEGBLKP(bp)) {
             next = NEXT_SEGBLKP(bp);
@@ -450,7 +1805,40 @@ static void check_seg_pointers()
                 printf("ERROR: Link at block %p is broken\n",bp );
             }
         }   
+
+    }
+
+    /*Check the bitmap agrees with the lists and the tree*/
+    for (int i = 0; i < LISTSIZE; i++) {
+        if (!(seg_bitmap & (1u << i)) != (SEGBLKP(free_listp,i) == NULL)) {
+            printf("ERROR: Bitmap bit %d is stale\n", i);
+        }
+    }
+}
+
+
+/**
+ * check_tree - Check the order and buckets of the blocks in a subtree
+ * @param t  Root of the subtree
+ * @param lo Block every key in the subtree must follow, or NULL
+ * @param hi Block every key in the subtree must precede, or NULL
+ * @return   number of blocks in the subtree
+ */
+static size_t check_tree(char *t, char *lo, char *hi)
+{
+    if (t == NULL) {
+        return 0;
+    }
+    if (GET_ALLOC(HDRP(t)) || get_list_index(GET_SIZE(HDRP(t))) != TREE_INDEX) {
+        printf("ERROR: Block %p does not belong in the tree\n", t);
+    }
+    if ((lo != NULL && !KEY_LT(GET_SIZE(HDRP(lo)), lo, t)) ||
+        (hi != NULL && !KEY_LT(GET_SIZE(HDRP(t)), t, hi))) {
+        printf("ERROR: Tree is out of order at %p\n", t);
+        return 1;
     }
+    return 1 + check_tree(LEFT_CHILD(t), lo, t) +
+        check_tree(RIGHT_CHILD(t), t, hi);
 }
 
 
@@ -463,6 +1851,9 @@ static void check_cycle()
     void *tortoise;
     /*Implementing Tortoise and hare algo, Iterating over each seg list*/
     for (int i = 0; i < LISTSIZE; ++i) {
+        if (i == TREE_INDEX) {
+            break;
+        }
         hare = SEGBLKP(free_listp,i);
         tortoise = SEGBLKP(free_listp,i);
 
@@ -497,8 +1888,9 @@ static void check_count_free_list()
             counti++;
         }
     }
-    /* Moving free list by pointers*/
-    for (int i = 0; i < LISTSIZE; i++) {
+    /* Moving free list by pointers, then the tree*/
+    countp = check_tree(SEGBLKP(free_listp, TREE_INDEX), NULL, NULL);
+    for (int i = 0; i < TREE_INDEX; i++) {
         for (bp = SEGBLKP(free_listp,i); (bp!=NULL)
           &&  (GET_SIZE(HDRP(bp)) > 0);bp = NEXT_SEGBLKP(bp)) {
             countp++;
@@ -507,8 +1899,8 @@ static void check_count_free_list()
 
     /*If count is not matching, print error, with debug Info*/
     if(countp!=counti) {
-        dbg_printf("free\n");
-        dbg_printf("all\n");
+        printf("ERROR: %u free blocks in the heap, %u in the free lists\n",
+               counti, countp);
     }
 }
 
@@ -523,19 +1915,23 @@ static void *list_add(void *bp)
     int index ;
 
     index = get_list_index(GET_SIZE(HDRP(bp)));
+    if (index == TREE_INDEX) {
+        tree_insert(bp);
+        return bp;
+    }
     /**
      * If the corresponding block is empty,
      * set its previous and next block as null
      */
     if (SEGBLKP(free_listp, index) == NULL) {
-        PREV_SEGBLKP(bp) = NULL;
-        NEXT_SEGBLKP(bp) = NULL;
+        SET_PREV_SEGBLKP(bp, NULL);
+        SET_NEXT_SEGBLKP(bp, NULL);
     }
     
     else if (SEGBLKP(free_listp, index) != NULL) {
-        NEXT_SEGBLKP(bp)= SEGBLKP(free_listp, index);
-        PREV_SEGBLKP(SEGBLKP(free_listp, index)) = bp;
-        PREV_SEGBLKP(bp) = NULL;
+        SET_NEXT_SEGBLKP(bp, SEGBLKP(free_listp, index));
+        SET_PREV_SEGBLKP(SEGBLKP(free_listp, index), bp);
+        SET_PREV_SEGBLKP(bp, NULL);
         
     }
 
@@ -545,6 +1941,7 @@ static void *list_add(void *bp)
      * of current block
      */
     (SEGBLKP(free_listp, index)) = bp;
+    seg_bitmap |= 1u << index;
     return bp;
 }
 
@@ -556,26 +1953,186 @@ static void *list_add(void *bp)
 static  inline void list_delete(void *bp)
 {
     int index = get_list_index(GET_SIZE(HDRP(bp)));
+    void *next;
+    void *prev;
 
-    void *next = NEXT_SEGBLKP(bp);
-    void *prev = PREV_SEGBLKP(bp);
+    if (index == TREE_INDEX) {
+        tree_delete(bp);
+        return;
+    }
+    next = NEXT_SEGBLKP(bp);
+    prev = PREV_SEGBLKP(bp);
     
     /* Delete the head of list */
     if(bp == SEGBLKP(free_listp, index)) {
         (SEGBLKP(free_listp, index)) = next;
+        if (next == NULL) {
+            seg_bitmap &= ~(1u << index);
+        }
     }
 
     if(prev != NULL) {
-        NEXT_SEGBLKP(prev) = next;
+        SET_NEXT_SEGBLKP(prev, next);
     }
 
     if(next != NULL) {
-        PREV_SEGBLKP(next) = prev;
+        SET_PREV_SEGBLKP(next, prev);
     }
 
     /*Clean Up task. Set next/prev pointers of bp to NULL*/
-    NEXT_SEGBLKP(bp) = NULL;
-    PREV_SEGBLKP(bp) = NULL;
+    SET_NEXT_SEGBLKP(bp, NULL);
+    SET_PREV_SEGBLKP(bp, NULL);
+}
+
+
+/**
+ * tree_splay - Top-down splay of the subtree rooted at t around the key
+ *              (size, bp). The new root is the block with that key if it
+ *              is in the subtree, else its predecessor or successor.
+ * @param t    Root of a non-empty subtree
+ * @param size Block size of the key
+ * @param bp   Block address of the key
+ * @return the new root of the subtree
+ */
+static char *tree_splay(char *t, size_t size, const void *bp)
+{
+    unsigned int l = 0;        /* Nodes known to precede the key */
+    unsigned int r = 0;        /* Nodes known to follow the key */
+    unsigned int *lp = &l;     /* Right link of the largest node in l */
+    unsigned int *rp = &r;     /* Left link of the smallest node in r */
+    char *y;
+
+    for (;;) {
+        STAT_PROBE();
+        if (KEY_LT(size, bp, t)) {
+            if ((y = LEFT_CHILD(t)) == NULL) {
+                break;
+            }
+            if (KEY_LT(size, bp, y)) {
+                /* Rotate right */
+                LEFT_LINK(t) = RIGHT_LINK(y);
+                SET_RIGHT_CHILD(y, t);
+                t = y;
+                if ((y = LEFT_CHILD(t)) == NULL) {
+                    break;
+                }
+            }
+            /* Link right */
+            *rp = LINK_OFFSET(t);
+            rp = &LEFT_LINK(t);
+            t = y;
+        } else if (t != bp) {
+            if ((y = RIGHT_CHILD(t)) == NULL) {
+                break;
+            }
+            if (!KEY_LT(size, bp, y) && y != bp) {
+                /* Rotate left */
+                RIGHT_LINK(t) = LEFT_LINK(y);
+                SET_LEFT_CHILD(y, t);
+                t = y;
+                if ((y = RIGHT_CHILD(t)) == NULL) {
+                    break;
+                }
+            }
+            /* Link left */
+            *lp = LINK_OFFSET(t);
+            lp = &RIGHT_LINK(t);
+            t = y;
+        } else {
+            break;
+        }
+    }
+
+    /* Reassemble */
+    *lp = LEFT_LINK(t);
+    *rp = RIGHT_LINK(t);
+    LEFT_LINK(t) = l;
+    RIGHT_LINK(t) = r;
+    return t;
+}
+
+
+/**
+ * tree_insert - Add a free block to the tree, as its new root
+ * @param bp Pointer pointing to the block being added
+ */
+static void tree_insert(void *bp)
+{
+    char *t = SEGBLKP(free_listp, TREE_INDEX);
+    size_t size = GET_SIZE(HDRP(bp));
+
+    if (t == NULL) {
+        SET_LEFT_CHILD(bp, NULL);
+        SET_RIGHT_CHILD(bp, NULL);
+    } else {
+        t = tree_splay(t, size, bp);
+        if (KEY_LT(size, bp, t)) {
+            LEFT_LINK(bp) = LEFT_LINK(t);
+            SET_RIGHT_CHILD(bp, t);
+            SET_LEFT_CHILD(t, NULL);
+        } else {
+            RIGHT_LINK(bp) = RIGHT_LINK(t);
+            SET_LEFT_CHILD(bp, t);
+            SET_RIGHT_CHILD(t, NULL);
+        }
+    }
+    SEGBLKP(free_listp, TREE_INDEX) = bp;
+    seg_bitmap |= 1u << TREE_INDEX;
+}
+
+
+/**
+ * tree_delete - Delete a block from the tree
+ * @param bp pointer pointing block deleted
+ */
+static void tree_delete(void *bp)
+{
+    char *t = tree_splay(SEGBLKP(free_listp, TREE_INDEX),
+                         GET_SIZE(HDRP(bp)), bp);
+
+    if (LEFT_CHILD(t) == NULL) {
+        t = RIGHT_CHILD(t);
+    } else {
+        /* Every key on the left precedes bp, so its largest comes up */
+        t = tree_splay(LEFT_CHILD(bp), GET_SIZE(HDRP(bp)), bp);
+        RIGHT_LINK(t) = RIGHT_LINK(bp);
+    }
+    SEGBLKP(free_listp, TREE_INDEX) = t;
+    if (t == NULL) {
+        seg_bitmap &= ~(1u << TREE_INDEX);
+    }
+    SET_LEFT_CHILD(bp, NULL);
+    SET_RIGHT_CHILD(bp, NULL);
+}
+
+
+/**
+ * tree_fit - Find the smallest block in the tree of at least asize bytes,
+ *            lowest address first among equal sizes
+ * @param asize size of the free block to be searched
+ * @return the best fit, or NULL if no block in the tree is large enough
+ */
+static void *tree_fit(size_t asize)
+{
+    char *t = SEGBLKP(free_listp, TREE_INDEX);
+    char *bp;
+
+    if (t == NULL) {
+        return NULL;
+    }
+    /* (asize, NULL) precedes every block of asize bytes */
+    t = tree_splay(t, asize, NULL);
+    SEGBLKP(free_listp, TREE_INDEX) = t;
+    if (GET_SIZE(HDRP(t)) >= asize) {
+        return t;
+    }
+    /* The root is the predecessor: the fit is the smallest on its right */
+    if (RIGHT_CHILD(t) == NULL) {
+        return NULL;
+    }
+    bp = tree_splay(RIGHT_CHILD(t), asize, NULL);
+    SET_RIGHT_CHILD(t, bp);
+    return bp;
 }
 
 
@@ -590,29 +2147,55 @@ static inline int in_heap(const void *p) {
 
 
 /**
- * mm_realloc - The function reallocates the memory, with new size
- *              by allcating a new block, and then deleting the previous
- *              block .
+ * realloc - The function reallocates the memory, with new size.
+ *              A regular block is resized in place when its neighbours
+ *              allow it, otherwise a new block is allocated, the data
+ *              copied, and the previous block deleted.
  * @param ptr  Block to be re-allocated
  * @param size New Size of the allocated memory
  */
-void *mm_realloc ( void *ptr, size_t size )
+void *realloc ( void *ptr, size_t size )
 {
     size_t oldsize;
     void *newptr;
     
     /* If size == 0 then this is just free, and we return NULL. */
     if(size == 0) {
-        mm_free(ptr);
+        free(ptr);
         return 0;
     }
     
     
     if(ptr == NULL) {
-        return mm_malloc(size);
+        return malloc(size);
+    }
+
+    /* No block that big fits, and ALIGN(WSIZE + size) would wrap */
+    if (size >= HEAP_MAX) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (!is_slab(ptr) && IS_MAPPED(HDRP(ptr))) {
+        /* A mapped block stays mapped until it shrinks below the threshold */
+        if (size >= mmap_threshold) {
+            HEAP_LOCK();
+            newptr = remap_block(ptr, size);
+            HEAP_UNLOCK();
+            return newptr;
+        }
+    } else if (size > SLAB_MAX_SIZE && !is_slab(ptr)) {
+        /* A heap block that can grow in place stays in the heap. Tiny
+           sizes move to a slab object, which has no room to grow */
+        HEAP_LOCK();
+        newptr = resize_block(ptr, ALIGN(WSIZE + size));
+        HEAP_UNLOCK();
+        if (newptr != NULL) {
+            return newptr;
+        }
     }
     
-    newptr = mm_malloc(size);
+    newptr = malloc(size);
     
     /* If realloc() fails the original block is left untouched  */
     if(!newptr) {
@@ -620,13 +2203,15 @@ void *mm_realloc ( void *ptr, size_t size )
     }
     
     /* Copy the old data. */
-    oldsize = GET_SIZE(HDRP(ptr));
+    oldsize = usable_size(ptr);
     if(size < oldsize)
         oldsize = size;
     memcpy(newptr, ptr, oldsize);
+    STAT_INC(realloc_copies);
+    STAT_ADD(realloc_copy_bytes, oldsize);
     
     /* Free the old block. */
-    mm_free(ptr);
+    free(ptr);
     return newptr;
 }
 
@@ -646,6 +2231,7 @@ void mm_checkheap(int verbose) {
      */
     
     char *bp = heap_listp;
+    size_t prev_alloc;
     
 
     if(verbose == 9) {
@@ -665,14 +2251,10 @@ void mm_checkheap(int verbose) {
         printf("ERROR: Bad prologue header\n");
     }
     
-    /* Check epilogue */
-    if ((GET_SIZE(HDRP(heap_listp)) != 0) || !(GET_ALLOC(HDRP(heap_listp)))) {
-        printf("ERROR: Bad epilogue header\n");
-    }
-    
     /* Check each block */
     /* boundaries, address alignment, header and footer, coalescing */
     bp = heap_listp;
+    prev_alloc = PREV_ALLOC;
     while (GET_SIZE(HDRP(bp)) > 0) {
         
         /* Address alignment */
@@ -685,15 +2267,22 @@ void mm_checkheap(int verbose) {
              dbg_printf("ERROR: %p is not in heap \n", bp);
         }
         
-        /* Block Header matching Footer */
-        if (GET(HDRP(bp)) != GET(FTRP(bp))) {
+        /* Free Block Header matching Footer */
+        if (!GET_ALLOC(HDRP(bp)) &&
+            GET(HDRP(bp)) != PACK(GET(FTRP(bp)), GET_PREV_ALLOC(HDRP(bp)))) {
             printf("ERROR: header does not match footer\n");
             dbg_printf("Heap_listp = %p \n", heap_listp );
             dbg_printf("Block %p \n", bp );
         }
+
+        /* Previous allocate bit consistency */
+        if (GET_PREV_ALLOC(HDRP(bp)) != prev_alloc) {
+            printf("ERROR: %p has a stale previous allocate bit\n", bp);
+        }
+        prev_alloc = GET_ALLOC(HDRP(bp)) ? PREV_ALLOC : 0;
         
         /* Coalescing with Next Block */
-        if( GET_ALLOC(HDRP(bp)) == 0 && NEXT_BLKP(bp)!= NULL
+        if( GET_ALLOC(HDRP(bp)) == 0
            && GET_ALLOC(HDRP(NEXT_BLKP(bp))) ==0 ) {
             printf("ERROR: %p is not coalesced with next block\n", bp);
             exit(1);
@@ -701,6 +2290,12 @@ void mm_checkheap(int verbose) {
         
         bp = NEXT_BLKP(bp);
     }
+
+    /* Check epilogue */
+    if (!GET_ALLOC(HDRP(bp)) || GET_PREV_ALLOC(HDRP(bp)) != prev_alloc ||
+        (void *)bp != (char *)mem_heap_hi() + 1) {
+        printf("ERROR: Bad epilogue header\n");
+    }
     
 
     /**
@@ -723,56 +2318,238 @@ void mm_checkheap(int verbose) {
 /**
  * calloc - Allocates a block of memory for an array of num elements,
  *          each of them size bytes long, and initializes all its bits to zero.
+ *          Mapped blocks and heap the block carves out of untouched space
+ *          are zero already, so only the rest is cleared.
  * @param nmemb Number of Memory Elements(Array of memory)
  * @param size  Size of each Memory Element(Array of memory)
  */
 void *calloc (size_t nmemb, size_t size) 
 {
     size_t bytes = nmemb * size;
-    void *newptr;
+    size_t asize;
+    char *bp;
+    char *zero;
+    char *ftr;
+
+    if ((size != 0 && bytes / size != nmemb) || bytes >= HEAP_MAX) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    STAT_INC(calloc_calls);
+    STAT_ADD(calloc_bytes, bytes);
+
+    /* A fresh mapping comes zeroed from the kernel */
+    if (bytes >= mmap_threshold) {
+        HEAP_LOCK();
+        bp = map_block(bytes);
+        HEAP_UNLOCK();
+        return bp;
+    }
 
-    newptr = malloc(bytes);
-    memset(newptr, 0, bytes);
+    /* Slab objects and cached blocks may hold anything */
+    if (bytes <= SLAB_MAX_SIZE) {
+        if ((bp = malloc(bytes)) != NULL) {
+            memset(bp, 0, bytes);
+            STAT_ADD(calloc_cleared, bytes);
+        }
+        return bp;
+    }
+    asize = ALIGN(WSIZE + bytes);
+    if ((bp = tcache_get(asize)) != NULL) {
+        memset(bp, 0, bytes);
+        STAT_ADD(calloc_cleared, bytes);
+        return bp;
+    }
 
-    return newptr;
+    HEAP_LOCK();
+    if (heap_listp == 0){
+        init_heap();
+    }
+    bp = alloc_block(asize);
+    zero = placed_zero;
+    HEAP_UNLOCK();
+    if (bp == NULL) {
+        return NULL;
+    }
+
+    /* The links of the free block it was carved from always need
+       clearing, and so does its footer if the block was not split */
+    zero = MIN(MAX(zero, bp + 2*WSIZE), bp + bytes);
+    memset(bp, 0, zero - bp);
+    ftr = bp + GET_SIZE(HDRP(bp)) - DSIZE;
+    if (ftr >= zero && ftr < bp + bytes) {
+        PUT(ftr, 0);
+    }
+    STAT_ADD(calloc_cleared, zero - bp);
+    return bp;
+}
+
+
+/**
+ * memalign - Allocate size bytes whose address is a multiple of align.
+ *            The block comes from the heap even when it is large, since
+ *            a mapped block only has DSIZE alignment.
+ * @param align alignment, a power of two
+ * @param size  requested payload size
+ */
+void *memalign (size_t align, size_t size)
+{
+    size_t asize;
+    char *bp;
+
+    if (align <= ALIGNMENT) {
+        return malloc(size);
+    }
+    if ((align & (align - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (size == 0) {
+        return NULL;
+    }
+    if (align >= HEAP_MAX || size >= HEAP_MAX) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    /* Keep it a real block: no slab object has an aligned address */
+    asize = ALIGN(WSIZE + MAX(size, SLAB_MAX_SIZE + 1));
+
+    HEAP_LOCK();
+    if (heap_listp == 0){
+        init_heap();
+    }
+    bp = alloc_aligned(asize, align);
+    HEAP_UNLOCK();
+    return bp;
+}
+
+
+/**
+ * posix_memalign - memalign that reports errors instead of setting errno
+ * @param memptr where to store the block
+ * @param align  alignment, a power of two multiple of sizeof(void *)
+ * @param size   requested payload size
+ * @return 0, EINVAL for a bad alignment, or ENOMEM
+ */
+int posix_memalign (void **memptr, size_t align, size_t size)
+{
+    void *bp;
+
+    if (align % sizeof(void *) != 0 || (align & (align - 1)) != 0) {
+        return EINVAL;
+    }
+    if ((bp = memalign(align, size)) == NULL && size != 0) {
+        return ENOMEM;
+    }
+    *memptr = bp;
+    return 0;
+}
+
+
+/**
+ * aligned_alloc - The C11 name of memalign
+ * @param align alignment, a power of two
+ * @param size  requested payload size
+ */
+void *aligned_alloc (size_t align, size_t size)
+{
+    return memalign(align, size);
+}
+
+
+/**
+ * malloc_usable_size - Bytes the caller may use at ptr, at least as many
+ *                      as it asked for
+ * @param ptr Block returned by malloc, or NULL
+ */
+size_t malloc_usable_size (void *ptr)
+{
+    return ptr ? usable_size(ptr) : 0;
+}
+
+
+/**
+ * usable_size - Payload bytes of an allocated block or slab object
+ * @param bp Block to measure
+ */
+static size_t usable_size(void *bp)
+{
+    if (is_slab(bp)) {
+        return RUNP(bp)->objsize;
+    }
+    if (IS_MAPPED(HDRP(bp))) {
+        return GET_SIZE(HDRP(bp)) - DSIZE;
+    }
+    return GET_SIZE(HDRP(bp)) - WSIZE;
 }
 
 
 /**
  * get_list_index - Given a asize of a block, return the its' index
 *                   in the list.
+ *                  List i holds blocks of at most SEG_LIST_BASE << i bytes,
+ *                  so the index is ceil(log2(asize / SEG_LIST_BASE)) and
+ *                  the tree takes blocks over 1024 bytes. The boundaries
+ *                  come from SEG_LIST_BASE alone, independent of
+ *                  MIN_BLOCK_SIZE.
  * @param - asize The size of current block
  * @return index of the block in the array
  */
 static inline unsigned int get_list_index(size_t asize)
 {
-    if (asize <= MIN_BLOCK_SIZE) {
+    size_t units = (asize + SEG_LIST_BASE - 1) / SEG_LIST_BASE;
+    unsigned int index;
+
+    if (units <= 1) {
         return 0;
-    } else if (asize <= MIN_BLOCK_SIZE << 1) {
-        return 1;
-    } else if (asize <= MIN_BLOCK_SIZE << 2) {
-        return 2;
-    } else if (asize <= MIN_BLOCK_SIZE << 3) {
-        return 3;
-    } else if (asize <= MIN_BLOCK_SIZE << 4) {
-        return 4;
-    } else if (asize <= MIN_BLOCK_SIZE << 5) {
-        return 5;
-    } else if (asize <= MIN_BLOCK_SIZE << 6) {
-        return 6;    
-    } else if (asize <= MIN_BLOCK_SIZE << 7) {
-        return 7;
-    } else if (asize <= MIN_BLOCK_SIZE << 8) {
-        return 8;
-    } else if (asize <= MIN_BLOCK_SIZE << 9) {
-        return 9;
-    } else if (asize <= MIN_BLOCK_SIZE << 10) {
-        return 10;
-    } else if (asize <= MIN_BLOCK_SIZE << 11) {
-        return 11;
-    } else if (asize <= MIN_BLOCK_SIZE << 12) {
-        return 12;
-    } else {
-        return 13;
     }
+    index = sizeof(unsigned long) * CHAR_BIT - __builtin_clzl(units - 1);
+    return (index < LISTSIZE) ? index : LISTSIZE - 1;
+}
+
+
+#ifndef DRIVER
+/*
+ * The rest of the malloc.h family. A program that got one of these from
+ * libc would hand the block to our free, so libmm.so has to provide them
+ * too.
+ */
+
+/**
+ * valloc - Allocate size bytes on a page boundary
+ * @param size requested payload size
+ */
+void *valloc (size_t size)
+{
+    return memalign(mem_pagesize(), size);
+}
+
+
+/**
+ * pvalloc - valloc with the size rounded up to whole pages
+ * @param size requested payload size
+ */
+void *pvalloc (size_t size)
+{
+    size_t pagesize = mem_pagesize();
+
+    /* The rounding would wrap before memalign could refuse the size */
+    if (size >= HEAP_MAX) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return memalign(pagesize, (size + pagesize - 1) & ~(pagesize - 1));
+}
+
+
+/**
+ * malloc_trim - glibc's name for mm_trim
+ * @param pad Bytes of free space to keep at the top of the heap
+ * @return 1 if any memory was released, 0 otherwise
+ */
+int malloc_trim (size_t pad)
+{
+    return mm_trim(pad) != 0;
 }
+#endif /* ndef DRIVER */
@@ -7,6 +7,11 @@ extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
 extern void *mm_calloc (size_t nmemb, size_t size);
+extern void *mm_memalign (size_t align, size_t size);
+extern int mm_posix_memalign (void **memptr, size_t align, size_t size);
+extern void *mm_aligned_alloc (size_t align, size_t size);
+extern void mm_free_sized (void *ptr, size_t size);
+extern size_t mm_malloc_usable_size (void *ptr);
 
 #else
 
@@ -15,10 +20,64 @@ extern void *malloc (size_t size);
 extern void free (void *ptr);
 extern void *realloc(void *ptr, size_t size);
 extern void *calloc (size_t nmemb, size_t size);
+extern void *memalign (size_t align, size_t size);
+extern size_t malloc_usable_size (void *ptr);
+extern int posix_memalign (void **memptr, size_t align, size_t size);
+extern void *aligned_alloc (size_t align, size_t size);
+extern void *valloc (size_t size);
+extern void *pvalloc (size_t size);
+extern void free_sized (void *ptr, size_t size);
+extern int malloc_trim (size_t pad);
 
 #endif
 
+/* Nonzero if the package may be called from several threads at once */
+extern const int mm_thread_safe;
+
 extern int mm_init(void);
+extern size_t mm_trim(size_t pad);
+extern void mm_set_mmap_threshold(size_t threshold);
+extern size_t mm_malloc_batch(size_t size, size_t n, void **out);
+extern void mm_free_batch(void **ptrs, size_t n);
 
 /* This is largely for debugging. */
 extern void mm_checkheap(int lineno);
+
+#define MM_CLASSES        8     /* One per seg list, the last is the tree */
+
+/* Snapshot of how the heap is laid out, filled in by mm_heap_info */
+typedef struct {
+    size_t heap_bytes;                 /* heap plus mmapped blocks */
+    size_t free_bytes[MM_CLASSES];     /* free block bytes per seg list */
+    size_t slab_free_bytes;            /* free objects in slab runs */
+    size_t largest_free;               /* largest free block */
+} mm_heap_info_t;
+
+extern void mm_heap_info(mm_heap_info_t *info);
+
+#ifdef MM_STATS
+#define MM_STATS_PROBES   12    /* Buckets of the probe histogram */
+
+/* Counters kept by an allocator built with -DMM_STATS, reset by mm_init */
+typedef struct {
+    /* find_fit calls by blocks visited: bucket 0 is none, bucket i holds
+       2^(i-1) to 2^i - 1 blocks, and the last bucket everything above */
+    unsigned long probes[MM_STATS_PROBES];
+
+    /* find_fit calls by size class of the request */
+    unsigned long class_hits[MM_CLASSES];   /* fit in its own class */
+    unsigned long class_spills[MM_CLASSES]; /* fit in a larger class */
+    unsigned long class_misses[MM_CLASSES]; /* no fit at all */
+
+    unsigned long coalesce[4];         /* mm_coalesce calls by case 1-4 */
+    unsigned long extend_calls;        /* extend_heap calls */
+    unsigned long extend_bytes;        /* bytes they added to the heap */
+    unsigned long realloc_copies;      /* reallocs that moved the block */
+    unsigned long realloc_copy_bytes;  /* bytes those reallocs copied */
+    unsigned long calloc_calls;        /* calloc calls */
+    unsigned long calloc_bytes;        /* bytes they asked for */
+    unsigned long calloc_cleared;      /* bytes they had to memset */
+} mm_stats_t;
+
+extern void mm_get_stats(mm_stats_t *stats);
+#endif
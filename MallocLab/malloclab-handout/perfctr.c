@@ -0,0 +1,157 @@
+/*
+ * perfctr.c - Count hardware events in a function f
+ *
+ * Each event gets its own perf_event_open counter, restricted to user
+ * space in the calling thread, so events the machine cannot count
+ * leave the others working. When the kernel multiplexes the counters,
+ * the counts are scaled by the fraction of time each one ran.
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "perfctr.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#define CACHE_EVENT(cache)  ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+                             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} events[PERFCTR_EVENTS] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_L1D) },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_DTLB) },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+static int fds[PERFCTR_EVENTS];    /* counter of each event, or -1 */
+static pid_t owner = 0;            /* process the counters count, 0 if
+                                      they are not open */
+
+/*
+ * open_event - Open a disabled counter of event i for the calling thread
+ */
+static int open_event(int i)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[i].type;
+    attr.config = events[i].config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+        PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* 
+ * perfctr_init - Open a disabled counter for every event we can count.
+ *     A forked child does not inherit counting: the counters it got from
+ *     its parent still count the parent, so it closes them and opens
+ *     its own.
+ */
+int perfctr_init(void)
+{
+    int i, n = 0;
+
+    if (owner == getpid()) {
+        for (i = 0; i < PERFCTR_EVENTS; i++)
+            n += fds[i] >= 0;
+        return n;
+    }
+    for (i = 0; owner != 0 && i < PERFCTR_EVENTS; i++) {
+        if (fds[i] >= 0)
+            close(fds[i]);
+    }
+    owner = getpid();
+
+    for (i = 0; i < PERFCTR_EVENTS; i++) {
+        fds[i] = open_event(i);
+        n += fds[i] >= 0;
+    }
+    return n;
+}
+
+/*
+ * perfctr_probe - Count the events we could count, without keeping any
+ *     counter open
+ */
+int perfctr_probe(void)
+{
+    int i, fd, n = 0;
+
+    for (i = 0; i < PERFCTR_EVENTS; i++) {
+        if ((fd = open_event(i)) >= 0) {
+            close(fd);
+            n++;
+        }
+    }
+    return n;
+}
+
+/* 
+ * perfctr_measure - Count the events in f(argp), averaged over n runs
+ */
+void perfctr_measure(perfctr_test_funct f, void *argp, int n,
+                     perfctr_t *result)
+{
+    uint64_t value[3];  /* count, time enabled, time running */
+    int i;
+
+    perfctr_init();
+    for (i = 0; i < PERFCTR_EVENTS; i++) {
+        if (fds[i] >= 0) {
+            ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+    for (i = 0; i < n; i++)
+        f(argp);
+    for (i = 0; i < PERFCTR_EVENTS; i++) {
+        if (fds[i] >= 0)
+            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    }
+
+    for (i = 0; i < PERFCTR_EVENTS; i++) {
+        result->count[i] = -1;
+        if (fds[i] < 0 ||
+            read(fds[i], value, sizeof(value)) != sizeof(value) ||
+            value[2] == 0)
+            continue;
+        result->count[i] = (double)value[0] * value[1] / value[2] / n;
+    }
+}
+
+#else /* !__linux__ */
+
+int perfctr_init(void)
+{
+    return 0;
+}
+
+int perfctr_probe(void)
+{
+    return 0;
+}
+
+void perfctr_measure(perfctr_test_funct f, void *argp, int n,
+                     perfctr_t *result)
+{
+    int i;
+
+    for (i = 0; i < PERFCTR_EVENTS; i++)
+        result->count[i] = -1;
+}
+
+#endif /* __linux__ */
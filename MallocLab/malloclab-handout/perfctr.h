@@ -0,0 +1,27 @@
+/*
+ * Hardware performance counters, read with perf_event_open
+ */
+#define PERFCTR_EVENTS 6
+
+/* Events counted, in this order */
+enum { PERFCTR_CYCLES, PERFCTR_INSTRUCTIONS, PERFCTR_L1D_MISSES,
+       PERFCTR_LLC_MISSES, PERFCTR_DTLB_MISSES, PERFCTR_BRANCH_MISSES };
+
+/* Event counts of one measurement; negative if the event is unavailable */
+typedef struct {
+    double count[PERFCTR_EVENTS];
+} perfctr_t;
+
+typedef void (*perfctr_test_funct)(void *);
+
+/* Open the counters for the calling thread, or again after a fork.
+   Return how many are available, 0 if the kernel or the machine has
+   none. perfctr_measure calls it */
+int perfctr_init(void);
+
+/* Return how many counters perfctr_init would open, opening none */
+int perfctr_probe(void);
+
+/* Count the events in f(argp). Return the average of n runs */
+void perfctr_measure(perfctr_test_funct f, void *argp, int n,
+                     perfctr_t *result);
@@ -0,0 +1,79 @@
+/*
+ * preload-test.c - Check that libmm.so refuses impossible sizes
+ *
+ * Run on mm.c with make check, or by hand:
+ *
+ *   unix> LD_PRELOAD=./libmm.so ./preload-test
+ *
+ * Every request below is too big for any heap or mapping, and some wrap
+ * when the allocator adds its overhead. Each must fail with ENOMEM and
+ * leave the block it was given untouched, instead of handing back a
+ * block smaller than asked for.
+ */
+#include <errno.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures = 0;
+
+/*
+ * expect_enomem - Report a request that did not fail with ENOMEM
+ */
+static void expect_enomem(const char *call, void *p)
+{
+    if (p != NULL || errno != ENOMEM) {
+        fprintf(stderr, "preload-test: %s returned %p, errno %d\n",
+                call, p, errno);
+        failures++;
+    }
+}
+
+int main(void)
+{
+    /* volatile, so gcc cannot see the sizes and warn or fold the calls */
+    volatile size_t huge = SIZE_MAX;
+    volatile size_t two = 2;
+    char *heap, *mapped;
+
+    errno = 0;
+    expect_enomem("malloc(SIZE_MAX)", malloc(huge));
+    errno = 0;
+    expect_enomem("malloc(SIZE_MAX - 4)", malloc(huge - 4));
+    errno = 0;
+    expect_enomem("malloc(UINT32_MAX)", malloc((size_t)UINT32_MAX));
+    errno = 0;
+    expect_enomem("calloc(SIZE_MAX, 2)", calloc(huge, two));
+    errno = 0;
+    expect_enomem("calloc(1, SIZE_MAX)", calloc(1, huge));
+    errno = 0;
+    expect_enomem("pvalloc(SIZE_MAX)", pvalloc(huge));
+
+    /* A heap block and a mapped one, which realloc grows differently */
+    heap = malloc(200);
+    mapped = malloc(1 << 20);
+    if (heap == NULL || mapped == NULL) {
+        fprintf(stderr, "preload-test: malloc failed\n");
+        return 1;
+    }
+    memset(heap, 'h', 200);
+    memset(mapped, 'm', 1 << 20);
+    errno = 0;
+    expect_enomem("realloc(heap, SIZE_MAX - 2)", realloc(heap, huge - 2));
+    errno = 0;
+    expect_enomem("realloc(mapped, SIZE_MAX - 2)", realloc(mapped, huge - 2));
+    if (heap[199] != 'h' || mapped[(1 << 20) - 1] != 'm') {
+        fprintf(stderr, "preload-test: failed realloc changed the block\n");
+        failures++;
+    }
+    free(heap);
+    free(mapped);
+
+    if (failures) {
+        return 1;
+    }
+    printf("preload-test: ok\n");
+    return 0;
+}
@@ -0,0 +1,646 @@
+/*
+ * recorder.c - Record the allocations of a live process as a .rep trace
+ *
+ * Built as librecorder.so and preloaded into a program, it forwards
+ * malloc, free, realloc, calloc and the memalign family to libc, and
+ * writes every call to a text trace that mdriver can replay:
+ *
+ *   unix> MM_RECORD_FILE=sort.rep LD_PRELOAD=./librecorder.so sort big.txt
+ *   unix> ./mdriver -f sort.rep
+ *
+ * Every block gets a new id when it is allocated, and keeps it across
+ * reallocs. Callocs are recorded as callocs of the total size, valloc and
+ * pvalloc as memaligns to the page size, and free_sized as a sized free
+ * when its size matches the block. Frees of blocks the recorder never
+ * saw, for instance ones allocated before it started, are left out.
+ *
+ * Each thread formats its requests into a buffer of its own and writes
+ * it out when it is full. An aligned request goes in with its allocation,
+ * so the two are never split up. A trace has a single order though, so a thread
+ * that frees or reallocs a block whose malloc still sits in the buffer of
+ * another thread writes out that buffer first. The header has fixed-width
+ * counts and is rewritten after every buffer, so the file is a valid
+ * trace of everything written so far, even if the program never exits.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "tracefmt.h"
+
+#define DEFAULT_FILE    "mm-record.rep"
+#define TBUF_SIZE       (64 * 1024)     /* bytes in a thread's buffer */
+#define OP_MAXLEN       32              /* longest formatted request */
+#define APPEND_MAXLEN   (2 * OP_MAXLEN) /* an aligned request and its alloc */
+#define HDR_FMT_LEN     26              /* "1\n" + two 10-digit counts + "0\n" */
+#define MIN_SLOTS       4096            /* slots in the first block table */
+
+/* libc's allocator, which this library forwards to */
+extern void *__libc_malloc(size_t size);
+extern void __libc_free(void *ptr);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_memalign(size_t align, size_t size);
+
+/* A thread's request buffer. Buffers are never unmapped: a thread that
+   exits writes its buffer out and leaves it for the next new thread */
+typedef struct tbuf {
+    pthread_mutex_t lock;       /* owner appends, other threads flush */
+    unsigned long flushes;      /* times the buffer was written out */
+    int nops;                   /* requests in data */
+    int max_id;                 /* largest id malloc'd in data, or -1 */
+    size_t len;
+    struct tbuf *next_all;      /* every buffer, for the final flush */
+    struct tbuf *next_free;     /* buffers of threads that have exited */
+    char data[TBUF_SIZE];
+} tbuf_t;
+
+/* A live block, in an open addressing table keyed by its address.
+   owner and gen say which buffer holds the request that gave it its id
+   and size, and whether that buffer has been written out since */
+typedef struct {
+    void *ptr;
+    int id;
+    uint32_t size;              /* size of its last request */
+    tbuf_t *owner;
+    unsigned long gen;
+} block_t;
+
+static enum { IDLE, RECORDING, DONE } state = IDLE;
+static int fd = -1;
+
+/* Totals of what is in the file, under file_lock */
+static pthread_mutex_t file_lock = PTHREAD_MUTEX_INITIALIZER;
+static int file_ops;
+static int file_max_id = -1;
+
+/* Block table and id counter, under table_lock */
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+static block_t *table;
+static size_t num_blocks, max_blocks;
+static int next_id;
+
+/* Buffer lists, under pool_lock */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static tbuf_t *all_bufs, *free_bufs;
+static pthread_key_t tbuf_key;
+
+static __thread tbuf_t *my_buf;
+static __thread int busy;       /* in the recorder, so libc calls from
+                                   pthread itself are not recorded */
+
+static void flush_locked(tbuf_t *b);
+static int new_id(void);
+
+
+/*
+ * write_header - Rewrite the counts at the start of the file.
+ *     Caller must hold file_lock.
+ */
+static void write_header(void)
+{
+    char hdr[HDR_FMT_LEN + 1];
+    int len;
+
+    len = snprintf(hdr, sizeof(hdr), "1\n%-10d\n%-10d\n0\n",
+                   file_max_id + 1, file_ops);
+    if (len != HDR_FMT_LEN || pwrite(fd, hdr, len, 0) != len)
+        state = DONE;
+}
+
+/*
+ * get_buf - The calling thread's buffer, taken from the pool on its first
+ *     request. NULL if there is no memory for one.
+ */
+static tbuf_t *get_buf(void)
+{
+    tbuf_t *b;
+
+    if (my_buf != NULL)
+        return my_buf;
+    pthread_mutex_lock(&pool_lock);
+    if ((b = free_bufs) != NULL) {
+        free_bufs = b->next_free;
+    } else if ((b = mmap(NULL, sizeof(tbuf_t), PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) != MAP_FAILED) {
+        pthread_mutex_init(&b->lock, NULL);
+        b->max_id = -1;
+        b->next_all = all_bufs;
+        all_bufs = b;
+    } else {
+        b = NULL;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    if (b != NULL) {
+        my_buf = b;
+        pthread_setspecific(tbuf_key, b);
+    }
+    return b;
+}
+
+/*
+ * put_buf - pthread key destructor: write out an exiting thread's buffer
+ *     and return it to the pool
+ */
+static void put_buf(void *arg)
+{
+    tbuf_t *b = arg;
+
+    pthread_mutex_lock(&b->lock);
+    flush_locked(b);
+    pthread_mutex_unlock(&b->lock);
+    pthread_mutex_lock(&pool_lock);
+    b->next_free = free_bufs;
+    free_bufs = b;
+    pthread_mutex_unlock(&pool_lock);
+    my_buf = NULL;
+}
+
+/*
+ * flush_locked - Append a buffer to the file and empty it. Bumps flushes
+ *     even if the buffer is empty. Caller must hold b->lock.
+ */
+static void flush_locked(tbuf_t *b)
+{
+    ssize_t n;
+    size_t done;
+
+    pthread_mutex_lock(&file_lock);
+    if (state == RECORDING && b->len > 0) {
+        for (done = 0; done < b->len; done += n) {
+            if ((n = write(fd, b->data + done, b->len - done)) <= 0) {
+                if (n < 0 && errno == EINTR) {
+                    n = 0;
+                    continue;
+                }
+                state = DONE;
+                break;
+            }
+        }
+        file_ops += b->nops;
+        if (b->max_id > file_max_id)
+            file_max_id = b->max_id;
+        if (state == RECORDING)
+            write_header();
+    }
+    pthread_mutex_unlock(&file_lock);
+    b->len = 0;
+    b->nops = 0;
+    b->max_id = -1;
+    b->flushes++;
+}
+
+/*
+ * format_uint - Write v in decimal at p, returning the end
+ */
+static char *format_uint(char *p, unsigned int v)
+{
+    char tmp[10];
+    int n = 0;
+
+    do {
+        tmp[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v != 0);
+    while (n > 0)
+        *p++ = tmp[--n];
+    return p;
+}
+
+/*
+ * format_op - Write one request line at p, returning the end
+ */
+static char *format_op(char *p, int type, int id, size_t size)
+{
+    if (type == ALIGNED) {
+        *p++ = "mpA"[id];           /* id is the ALIGN_* kind */
+    } else {
+        *p++ = type == ALLOC ? 'a' : type == CALLOC ? 'c' :
+            type == REALLOC ? 'r' : type == FREE_SIZED ? 's' : 'f';
+        *p++ = ' ';
+        p = format_uint(p, id);
+    }
+    if (type != FREE) {
+        *p++ = ' ';
+        p = format_uint(p, size);
+    }
+    *p++ = '\n';
+    return p;
+}
+
+/*
+ * append - Add a request to the calling thread's buffer
+ * @param pre if not NULL, the ALIGNED request to add right before it
+ * @param gen if not NULL, where to store the buffer's flush count
+ * @return the buffer, or NULL if the request could not be recorded
+ */
+static tbuf_t *append(int type, int id, size_t size, const traceop_t *pre,
+                      unsigned long *gen)
+{
+    tbuf_t *b;
+    char *p;
+
+    if ((b = get_buf()) == NULL)
+        return NULL;
+    pthread_mutex_lock(&b->lock);
+    if (b->len + APPEND_MAXLEN > TBUF_SIZE)
+        flush_locked(b);
+    p = b->data + b->len;
+    if (pre != NULL) {
+        p = format_op(p, pre->type, pre->index, pre->size);
+        b->nops++;
+    }
+    p = format_op(p, type, id, size);
+    b->len = p - b->data;
+    b->nops++;
+    if ((type == ALLOC || type == CALLOC) && id > b->max_id)
+        b->max_id = id;
+    if (gen != NULL)
+        *gen = b->flushes;
+    pthread_mutex_unlock(&b->lock);
+    return b;
+}
+
+/*
+ * sync_owner - Make sure the request that gave a block its id is in the
+ *     file before the calling thread records another one for it
+ */
+static void sync_owner(const block_t *blk)
+{
+    if (blk->owner == my_buf)
+        return;
+    pthread_mutex_lock(&blk->owner->lock);
+    if (blk->owner->flushes == blk->gen)
+        flush_locked(blk->owner);
+    pthread_mutex_unlock(&blk->owner->lock);
+}
+
+
+/*
+ * The block table: linear probing, with deletions that shift the rest of
+ * the probe run back instead of leaving tombstones. Callers hold
+ * table_lock.
+ */
+
+static size_t slot_of(const void *ptr)
+{
+    return (size_t)(((uintptr_t)ptr >> 4) * 0x9e3779b97f4a7c15ull) &
+        (max_blocks - 1);
+}
+
+static block_t *find_slot(const void *ptr)
+{
+    size_t i;
+
+    for (i = slot_of(ptr); table[i].ptr != NULL; i = (i + 1) & (max_blocks - 1)) {
+        if (table[i].ptr == ptr)
+            break;
+    }
+    return &table[i];
+}
+
+/*
+ * table_insert - Enter a live block, doubling the table once it is half
+ *     full. Returns -1 if it cannot grow.
+ */
+static int table_insert(const block_t *blk)
+{
+    block_t *old = table;
+    size_t old_max = max_blocks;
+    size_t i;
+
+    if (2 * (num_blocks + 1) > max_blocks) {
+        max_blocks = max_blocks ? 2 * max_blocks : MIN_SLOTS;
+        table = mmap(NULL, max_blocks * sizeof(block_t), PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (table == MAP_FAILED) {
+            table = old;
+            max_blocks = old_max;
+            return -1;
+        }
+        for (i = 0; i < old_max; i++) {
+            if (old[i].ptr != NULL)
+                *find_slot(old[i].ptr) = old[i];
+        }
+        if (old != NULL)
+            munmap(old, old_max * sizeof(block_t));
+    }
+    *find_slot(blk->ptr) = *blk;
+    num_blocks++;
+    return 0;
+}
+
+/*
+ * table_remove - Take the block at ptr out of the table
+ * @return 1 with the block in *blk, or 0 if it is not there
+ */
+static int table_remove(const void *ptr, block_t *blk)
+{
+    size_t mask = max_blocks - 1;
+    size_t i, j, home;
+
+    if (table == NULL || find_slot(ptr)->ptr == NULL)
+        return 0;
+    *blk = *find_slot(ptr);
+    i = j = find_slot(ptr) - table;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (table[j].ptr == NULL)
+            break;
+        home = slot_of(table[j].ptr);
+        /* Entry j may fill the hole at i if its home is not in (i, j] */
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            table[i] = table[j];
+            i = j;
+        }
+    }
+    table[i].ptr = NULL;
+    num_blocks--;
+    return 1;
+}
+
+
+/*
+ * new_id - Hand out the next block id, or -1 once the trace format has
+ *     run out of them
+ */
+static int new_id(void)
+{
+    int id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+
+    return id < TRACE_MAX_IDS ? id : -1;
+}
+
+/*
+ * record_alloc - Record a new block of size bytes at ptr
+ * @param type ALLOC or CALLOC
+ * @param pre  if not NULL, the ALIGNED request that makes it an aligned
+ *             allocation
+ */
+static void record_alloc(int type, void *ptr, size_t size,
+                         const traceop_t *pre)
+{
+    block_t blk;
+
+    if (ptr == NULL || size > INT_MAX || (blk.id = new_id()) < 0)
+        return;
+    /* The request goes in the buffer before the block goes in the table,
+       so a thread that finds it there can flush it */
+    blk.ptr = ptr;
+    blk.size = size;
+    if ((blk.owner = append(type, blk.id, size, pre, &blk.gen)) == NULL)
+        return;
+    pthread_mutex_lock(&table_lock);
+    table_insert(&blk);
+    pthread_mutex_unlock(&table_lock);
+}
+
+/*
+ * take_block - Remove the block at ptr from the table before it is freed
+ *     or moved, and make sure its last request is in the file
+ * @return 1 with the block in *blk, 0 if the recorder never saw it
+ */
+static int take_block(void *ptr, block_t *blk)
+{
+    int found;
+
+    pthread_mutex_lock(&table_lock);
+    found = table_remove(ptr, blk);
+    pthread_mutex_unlock(&table_lock);
+    if (found)
+        sync_owner(blk);
+    return found;
+}
+
+/*
+ * recording - Should the calling thread record its request
+ */
+static inline int recording(void)
+{
+    return __atomic_load_n(&state, __ATOMIC_RELAXED) == RECORDING && !busy;
+}
+
+
+/*
+ * aligned - Allocate size bytes aligned to align with libc, and record an
+ *     aligned allocation made by the call of the given ALIGN_* kind
+ */
+static void *aligned(int kind, size_t align, size_t size)
+{
+    traceop_t pre = { .type = ALIGNED, .index = kind, .size = align };
+    void *p = __libc_memalign(align, size);
+
+    if (recording()) {
+        busy = 1;
+        /* mdriver only replays alignments that are powers of two */
+        if (align == 0 || (align & (align - 1)) != 0 || align > UINT32_MAX)
+            record_alloc(ALLOC, p, size, NULL);
+        else
+            record_alloc(ALLOC, p, size, &pre);
+        busy = 0;
+    }
+    return p;
+}
+
+
+/*
+ * The interposed allocator
+ */
+
+void *malloc(size_t size)
+{
+    void *p = __libc_malloc(size);
+
+    if (recording()) {
+        busy = 1;
+        record_alloc(ALLOC, p, size, NULL);
+        busy = 0;
+    }
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p = __libc_calloc(nmemb, size);
+
+    if (recording()) {
+        busy = 1;
+        record_alloc(CALLOC, p, nmemb * size, NULL);
+        busy = 0;
+    }
+    return p;
+}
+
+void free(void *ptr)
+{
+    block_t blk;
+
+    if (ptr != NULL && recording()) {
+        busy = 1;
+        if (take_block(ptr, &blk))
+            append(FREE, blk.id, 0, NULL, NULL);
+        busy = 0;
+    }
+    __libc_free(ptr);
+}
+
+void free_sized(void *ptr, size_t size)
+{
+    block_t blk;
+
+    if (ptr != NULL && recording()) {
+        busy = 1;
+        if (take_block(ptr, &blk)) {
+            if (size == blk.size)
+                append(FREE_SIZED, blk.id, size, NULL, NULL);
+            else
+                append(FREE, blk.id, 0, NULL, NULL);
+        }
+        busy = 0;
+    }
+    __libc_free(ptr);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    block_t blk;
+    void *p;
+    int found;
+
+    if (ptr == NULL || !recording())
+        return ptr == NULL ? malloc(size) : __libc_realloc(ptr, size);
+
+    busy = 1;
+    found = take_block(ptr, &blk);
+    p = __libc_realloc(ptr, size);
+    if (p == NULL && size != 0) {
+        /* The old block is still there */
+        if (found) {
+            pthread_mutex_lock(&table_lock);
+            table_insert(&blk);
+            pthread_mutex_unlock(&table_lock);
+        }
+    } else if (!found) {
+        record_alloc(ALLOC, p, size, NULL);
+    } else if (p == NULL || size > INT_MAX) {
+        append(FREE, blk.id, 0, NULL, NULL);
+    } else {
+        blk.ptr = p;
+        blk.size = size;
+        if ((blk.owner = append(REALLOC, blk.id, size, NULL,
+                                &blk.gen)) != NULL) {
+            pthread_mutex_lock(&table_lock);
+            table_insert(&blk);
+            pthread_mutex_unlock(&table_lock);
+        }
+    }
+    busy = 0;
+    return p;
+}
+
+void *memalign(size_t align, size_t size)
+{
+    return aligned(ALIGN_MEMALIGN, align, size);
+}
+
+int posix_memalign(void **memptr, size_t align, size_t size)
+{
+    void *p;
+
+    if (align % sizeof(void *) != 0 || (align & (align - 1)) != 0)
+        return EINVAL;
+    if ((p = aligned(ALIGN_POSIX, align, size)) == NULL && size != 0)
+        return ENOMEM;
+    *memptr = p;
+    return 0;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+    return aligned(ALIGN_ALLOC, align, size);
+}
+
+/* valloc and pvalloc are memaligns to the page size, which pvalloc also
+   rounds the size up to */
+void *valloc(size_t size)
+{
+    return aligned(ALIGN_MEMALIGN, getpagesize(), size);
+}
+
+void *pvalloc(size_t size)
+{
+    size_t pagesize = getpagesize();
+
+    if (size > SIZE_MAX - pagesize) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    size = size ? (size + pagesize - 1) & ~(pagesize - 1) : pagesize;
+    return aligned(ALIGN_MEMALIGN, pagesize, size);
+}
+
+
+/*
+ * stop_in_child - A forked child shares the file offset with its parent,
+ *     so only the parent records
+ */
+static void stop_in_child(void)
+{
+    state = DONE;
+}
+
+/*
+ * recorder_init - Open the trace and start recording
+ */
+__attribute__((constructor))
+static void recorder_init(void)
+{
+    const char *file = getenv("MM_RECORD_FILE");
+
+    if (file == NULL || *file == '\0')
+        file = DEFAULT_FILE;
+    if ((fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0 ||
+        pthread_key_create(&tbuf_key, put_buf) != 0 ||
+        pthread_atfork(NULL, NULL, stop_in_child) != 0) {
+        state = DONE;
+        return;
+    }
+    state = RECORDING;
+    pthread_mutex_lock(&file_lock);
+    write_header();
+    if (lseek(fd, HDR_FMT_LEN, SEEK_SET) < 0)
+        state = DONE;
+    pthread_mutex_unlock(&file_lock);
+}
+
+/*
+ * recorder_fini - Write out every buffer at exit. Threads that are still
+ *     running stop recording here.
+ */
+__attribute__((destructor))
+static void recorder_fini(void)
+{
+    tbuf_t *b;
+
+    if (state != RECORDING)
+        return;
+    busy = 1;
+    pthread_mutex_lock(&pool_lock);
+    for (b = all_bufs; b != NULL; b = b->next_all) {
+        pthread_mutex_lock(&b->lock);
+        flush_locked(b);
+        pthread_mutex_unlock(&b->lock);
+    }
+    pthread_mutex_unlock(&pool_lock);
+    pthread_mutex_lock(&file_lock);
+    state = DONE;
+    close(fd);
+    pthread_mutex_unlock(&file_lock);
+}
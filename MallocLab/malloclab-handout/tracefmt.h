@@ -0,0 +1,56 @@
+#ifndef __TRACEFMT_H_
+#define __TRACEFMT_H_
+
+/*
+ * tracefmt.h - Binary trace format read by mdriver
+ *
+ * A binary trace is a tracehdr_t followed by num_ops traceop_t records,
+ * all in host byte order. mdriver maps the file and replays the op array
+ * where it lies, so traceop_t is both the in-memory and the on-disk
+ * layout. mdriver -w converts a text .rep trace to this format.
+ */
+#include <stdint.h>
+
+#define TRACE_MAGIC     0x52544d4du  /* "MMTR" */
+#define TRACE_VERSION   2            /* bumped whenever a request type is added */
+#define TRACE_MAX_IDS   (1 << 27)    /* ids must fit the index field */
+
+/*
+ * Request types; the values are part of the file format. A BATCH request
+ * has index 0 and groups the size requests after it, which are either
+ * all ALLOCs of one size or all FREEs. An ALIGNED request makes the ALLOC
+ * right after it an aligned allocation: its size is the alignment and
+ * its index the call that makes it. A FREE_SIZED request is a free that
+ * passes the block's size along.
+ */
+enum { ALLOC = 0, FREE = 1, REALLOC = 2, CALLOC = 3, BATCH = 4, ALIGNED = 5,
+       FREE_SIZED = 6 };
+
+/*
+ * Last request type a trace of each version may hold. Version 1 had
+ * ALLOC, FREE and REALLOC only; version 2 added CALLOC, BATCH, ALIGNED
+ * and FREE_SIZED. mdriver reads every version up to TRACE_VERSION.
+ */
+#define TRACE_LAST_TYPE(version) ((version) == 1 ? REALLOC : FREE_SIZED)
+
+/* Calls an ALIGNED request stands for */
+enum { ALIGN_MEMALIGN = 0, ALIGN_POSIX = 1, ALIGN_ALLOC = 2 };
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct {
+    unsigned int type : 4;            /* type of request */
+    int index : 28;                   /* index for free() to use later */
+    uint32_t size;                    /* byte size of alloc/realloc request */
+} traceop_t;
+
+/* Header of a binary trace, the same fields as a text trace header */
+typedef struct {
+    uint32_t magic;                   /* TRACE_MAGIC */
+    uint32_t version;                 /* TRACE_VERSION */
+    int32_t weight;
+    int32_t num_ids;
+    int32_t num_ops;
+    int32_t ignore_ranges;
+} tracehdr_t;
+
+#endif /* __TRACEFMT_H_ */
@@ -0,0 +1,669 @@
+/*
+ * tracegen.c - Synthesize allocator traces from a workload model
+ *
+ * Writes a trace in the text .rep format, or in the binary format of
+ * tracefmt.h with -b, that mdriver can replay. The workload is a list of
+ * phases, each given with -p as comma-separated key=value pairs:
+ *
+ *   n=COUNT            mallocs in the phase
+ *   size=fixed:N       every request is N bytes
+ *   size=uniform:A:B   uniform between A and B bytes
+ *   size=bimodal:A:B:P A bytes with probability P, else B bytes
+ *   size=power:A:B:S   power law between A and B bytes, exponent S
+ *   life=exp:MEAN      freed after an exponential number of mallocs
+ *   life=fixed:N       freed exactly N mallocs later, in FIFO order
+ *   life=lifo:DEPTH    stack: once DEPTH are live, the newest half is freed
+ *   life=prodcons:B:D  producer/consumer: blocks are queued, and every B
+ *                      mallocs the oldest B are freed once D are queued
+ *   life=forever       freed only at the end of the trace
+ *   realloc=P:F:MAX    a block starts a growth chain with probability P,
+ *                      growing by factor F per realloc up to MAX bytes
+ *   calloc=P           a malloc is a calloc with probability P
+ *   batch=N            mallocs come in batches of N blocks of one size,
+ *                      and the frees due at once in batches of up to N;
+ *                      batched mallocs are never callocs or aligned
+ *   align=P:A          a malloc is a memalign, posix_memalign or
+ *                      aligned_alloc to A bytes with probability P
+ *   sized=P            a block is freed with free_sized with probability
+ *                      P, unless its free is batched
+ *
+ * Blocks keep the lifetime model of the phase they were born in, so a
+ * phase change leaves the blocks of earlier phases behind. Everything
+ * still live is freed at the end. The same seed gives the same trace.
+ *
+ *   unix> ./tracegen -s 7 -o big.rep \
+ *             -p n=1000000,size=power:16:65536:1.2,life=exp:2000 \
+ *             -p n=500000,size=bimodal:24:4096:0.9,life=prodcons:64:4096
+ *
+ * "mallocs" above counts callocs and aligned allocations too; a malloc is
+ * never both.
+ */
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tracefmt.h"
+
+#define MAXPHASES   64
+#define MAXCHAINS   1024    /* growth chains in progress at once */
+
+enum { SIZE_FIXED, SIZE_UNIFORM, SIZE_BIMODAL, SIZE_POWER };
+enum { LIFE_EXP, LIFE_FIXED, LIFE_LIFO, LIFE_PRODCONS, LIFE_FOREVER };
+
+/* One phase of the workload */
+typedef struct {
+    long n;                 /* mallocs in the phase */
+    int size_kind;
+    double size_a, size_b, size_p;
+    int life_kind;
+    double life_a, life_b;
+    double realloc_p;       /* chance that a block starts a growth chain */
+    double realloc_factor;
+    double realloc_max;
+    double calloc_p;        /* chance that a malloc is a calloc */
+    int batch;              /* requests per batch, 0 or 1 for none */
+    double align_p;         /* chance that a malloc is an aligned one */
+    uint32_t align;         /* alignment of the aligned mallocs */
+    double sized_p;         /* chance that a block gets a sized free */
+} phase_t;
+
+/* A block due to be freed at tick death, in the min-heap of deadlines */
+typedef struct {
+    long death;
+    int id;
+} deadline_t;
+
+/* A block that is being grown by a chain of reallocs */
+typedef struct {
+    int id;
+    uint32_t size;
+    uint32_t max;
+    double factor;
+} chain_t;
+
+/* Growable arrays of ops, deadlines and block ids */
+static traceop_t *ops;
+static long num_ops, max_ops;
+static deadline_t *heap;
+static long heap_len, heap_max;
+static int *stack, *queue;
+static long stack_len, stack_max, queue_head, queue_len, queue_max;
+static chain_t chains[MAXCHAINS];
+static int num_chains;
+static int num_ids;
+static uint32_t *sized;     /* size to pass free_sized for each id, or 0 */
+static long sized_max;
+static int batch_max;       /* requests per batch of the open batch */
+static long batch_op = -1;  /* index of the open BATCH request, or -1 */
+
+static uint64_t rng_state;
+
+static void die(const char *fmt, ...)
+    __attribute__((format(printf, 1, 2), noreturn));
+
+/*
+ * die - Print an error message and exit
+ */
+static void die(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    fprintf(stderr, "tracegen: ");
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    exit(1);
+}
+
+/*
+ * grow - Make room for one more element in a growable array
+ */
+static void *grow(void *array, long len, long *max, size_t elem)
+{
+    if (len < *max)
+        return array;
+    *max = *max ? 2 * *max : 1024;
+    if ((array = realloc(array, *max * elem)) == NULL)
+        die("out of memory");
+    return array;
+}
+
+/*
+ * rnd - Uniform double in [0, 1), from xorshift64*
+ */
+static double rnd(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (rng_state * 2685821657736338717ull >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * emit - Append one request to the trace
+ */
+static void emit(int type, int id, uint32_t size)
+{
+    ops = grow(ops, num_ops, &max_ops, sizeof(*ops));
+    ops[num_ops].type = type;
+    ops[num_ops].index = id;
+    ops[num_ops].size = size;
+    num_ops++;
+}
+
+/*
+ * open_batch - Start grouping the next requests into a batch of at most
+ *     max requests, unless max is less than 2
+ */
+static void open_batch(int max)
+{
+    if (max < 2)
+        return;
+    batch_max = max;
+    batch_op = num_ops;
+    emit(BATCH, 0, 0);
+}
+
+/*
+ * close_batch - End the open batch, and drop its BATCH request if it
+ *     got fewer than two requests
+ */
+static void close_batch(void)
+{
+    long n;
+
+    if (batch_op < 0)
+        return;
+    n = num_ops - batch_op - 1;
+    if (n >= 2) {
+        ops[batch_op].size = n;
+    } else {
+        memmove(&ops[batch_op], &ops[batch_op + 1], n * sizeof(*ops));
+        num_ops--;
+    }
+    batch_op = -1;
+}
+
+/*
+ * draw_size - Draw a request size from the size model of phase ph
+ */
+static uint32_t draw_size(const phase_t *ph)
+{
+    double a = ph->size_a, b = ph->size_b, x;
+
+    switch (ph->size_kind) {
+    case SIZE_UNIFORM:
+        x = a + rnd() * (b - a + 1);
+        break;
+    case SIZE_BIMODAL:
+        x = (rnd() < ph->size_p) ? a : b;
+        break;
+    case SIZE_POWER:
+        /* Inverse CDF of a Pareto distribution truncated to [a, b] */
+        x = a * pow(1 - rnd() * (1 - pow(a / b, ph->size_p)),
+                    -1 / ph->size_p);
+        break;
+    default:
+        x = a;
+    }
+    if (x < 1)
+        x = 1;
+    if (x > UINT32_MAX)
+        x = UINT32_MAX;
+    return (uint32_t)x;
+}
+
+/*
+ * push_deadline - Schedule block id to be freed at tick death
+ */
+static void push_deadline(long death, int id)
+{
+    long i;
+
+    heap = grow(heap, heap_len, &heap_max, sizeof(*heap));
+    for (i = heap_len++; i > 0 && heap[(i - 1) / 2].death > death;
+         i = (i - 1) / 2)
+        heap[i] = heap[(i - 1) / 2];
+    heap[i].death = death;
+    heap[i].id = id;
+}
+
+/*
+ * pop_deadline - Remove the block with the earliest deadline
+ */
+static int pop_deadline(void)
+{
+    deadline_t last = heap[--heap_len];
+    int id = heap[0].id;
+    long i = 0, child;
+
+    while ((child = 2 * i + 1) < heap_len) {
+        if (child + 1 < heap_len && heap[child + 1].death < heap[child].death)
+            child++;
+        if (heap[child].death >= last.death)
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    if (heap_len > 0)
+        heap[i] = last;
+    return id;
+}
+
+/*
+ * release - Free a block, ending its growth chain if it has one
+ */
+static void release(int id)
+{
+    int c;
+
+    for (c = 0; c < num_chains; c++) {
+        if (chains[c].id == id) {
+            chains[c] = chains[--num_chains];
+            break;
+        }
+    }
+    if (batch_op >= 0 && num_ops - batch_op - 1 == batch_max) {
+        close_batch();
+        open_batch(batch_max);
+    }
+    if (batch_op < 0 && sized[id] != 0)
+        emit(FREE_SIZED, id, sized[id]);
+    else
+        emit(FREE, id, 0);
+}
+
+/*
+ * advance_chain - Grow a random block of a growth chain by one realloc
+ */
+static void advance_chain(void)
+{
+    int c = (int)(rnd() * num_chains);
+    chain_t *ch = &chains[c];
+    double size = ch->size * ch->factor;
+
+    if (size <= ch->size)
+        size = ch->size + 1;
+    if (size >= ch->max)
+        size = ch->max;
+    ch->size = (uint32_t)size;
+    emit(REALLOC, ch->id, ch->size);
+    if (sized[ch->id] != 0)
+        sized[ch->id] = ch->size;
+    if (ch->size >= ch->max)
+        *ch = chains[--num_chains];
+}
+
+/*
+ * run_phase - Emit the requests of one phase, starting at tick *tick
+ */
+static void run_phase(const phase_t *ph, long *tick)
+{
+    long i, k, life;
+    long batch_left = 0;
+    uint32_t size, batch_size = 0;
+    int id;
+
+    for (i = 0; i < ph->n; i++, (*tick)++) {
+        /* Free whatever is due */
+        open_batch(ph->batch);
+        while (heap_len > 0 && heap[0].death <= *tick)
+            release(pop_deadline());
+        close_batch();
+
+        /* Grow a chain every other tick or so */
+        if (num_chains > 0 && rnd() < 0.5)
+            advance_chain();
+
+        /* A batch mallocs the blocks of its next few ticks up front */
+        if (ph->batch > 1 && batch_left == 0) {
+            batch_left = (ph->n - i < ph->batch) ? ph->n - i : ph->batch;
+            batch_size = draw_size(ph);
+            open_batch(ph->batch);
+            for (k = 0; k < batch_left; k++)
+                emit(ALLOC, num_ids + k, batch_size);
+            close_batch();
+        }
+
+        id = num_ids++;
+        if (batch_left > 0) {
+            size = batch_size;
+            batch_left--;
+        } else {
+            size = draw_size(ph);
+            if (ph->calloc_p > 0 && rnd() < ph->calloc_p) {
+                emit(CALLOC, id, size);
+            } else {
+                if (ph->align_p > 0 && rnd() < ph->align_p)
+                    emit(ALIGNED, (int)(rnd() * 3), ph->align);
+                emit(ALLOC, id, size);
+            }
+        }
+        sized = grow(sized, id, &sized_max, sizeof(*sized));
+        sized[id] = (ph->sized_p > 0 && rnd() < ph->sized_p) ? size : 0;
+
+        if (ph->realloc_p > 0 && num_chains < MAXCHAINS &&
+            rnd() < ph->realloc_p) {
+            chains[num_chains].id = id;
+            chains[num_chains].size = size;
+            chains[num_chains].max = (uint32_t)ph->realloc_max;
+            chains[num_chains].factor = ph->realloc_factor;
+            if (chains[num_chains].size < chains[num_chains].max)
+                num_chains++;
+        }
+
+        switch (ph->life_kind) {
+        case LIFE_EXP:
+            life = 1 + (long)(-ph->life_a * log(1 - rnd()));
+            push_deadline(*tick + life, id);
+            break;
+        case LIFE_FIXED:
+            push_deadline(*tick + (long)ph->life_a, id);
+            break;
+        case LIFE_LIFO:
+            stack = grow(stack, stack_len, &stack_max, sizeof(*stack));
+            stack[stack_len++] = id;
+            if (stack_len >= (long)ph->life_a) {
+                open_batch(ph->batch);
+                for (k = stack_len / 2; k > 0; k--)
+                    release(stack[--stack_len]);
+                close_batch();
+            }
+            break;
+        case LIFE_PRODCONS:
+            if (queue_head > 0 && queue_head + queue_len == queue_max) {
+                memmove(queue, queue + queue_head, queue_len * sizeof(*queue));
+                queue_head = 0;
+            }
+            queue = grow(queue, queue_head + queue_len, &queue_max,
+                         sizeof(*queue));
+            queue[queue_head + queue_len++] = id;
+            if ((i + 1) % (long)ph->life_a == 0 && queue_len > ph->life_b) {
+                open_batch(ph->batch);
+                for (k = 0; k < (long)ph->life_a && queue_len > 0; k++) {
+                    release(queue[queue_head++]);
+                    queue_len--;
+                }
+                close_batch();
+            }
+            break;
+        default:
+            push_deadline(LONG_MAX, id);
+        }
+    }
+}
+
+/*
+ * parse_nums - Parse up to max colon-separated numbers; return the count
+ */
+static int parse_nums(const char *s, double *v, int max, const char *what)
+{
+    char *end;
+    int n = 0;
+
+    while (n < max) {
+        v[n++] = strtod(s, &end);
+        if (end == s)
+            die("bad number in %s", what);
+        if (*end != ':')
+            break;
+        s = end + 1;
+    }
+    if (*end != '\0' && *end != ',')
+        die("too many values in %s", what);
+    return n;
+}
+
+/*
+ * parse_phase - Fill in ph from a -p argument
+ */
+static void parse_phase(phase_t *ph, const char *spec)
+{
+    const char *p = spec;
+    double v[3];
+    int n;
+
+    memset(ph, 0, sizeof(*ph));
+    ph->n = 100000;
+    ph->size_kind = SIZE_FIXED;
+    ph->size_a = 64;
+    ph->life_kind = LIFE_EXP;
+    ph->life_a = 1000;
+
+    while (*p != '\0') {
+        if (strncmp(p, "n=", 2) == 0) {
+            parse_nums(p + 2, v, 1, spec);
+            ph->n = (long)v[0];
+        } else if (strncmp(p, "size=", 5) == 0) {
+            p += 5;
+            if (strncmp(p, "fixed:", 6) == 0) {
+                ph->size_kind = SIZE_FIXED;
+                parse_nums(p + 6, v, 1, spec);
+            } else if (strncmp(p, "uniform:", 8) == 0) {
+                ph->size_kind = SIZE_UNIFORM;
+                n = parse_nums(p + 8, v, 2, spec);
+                if (n != 2 || v[1] < v[0])
+                    die("size=uniform needs A:B with A <= B");
+            } else if (strncmp(p, "bimodal:", 8) == 0) {
+                ph->size_kind = SIZE_BIMODAL;
+                if (parse_nums(p + 8, v, 3, spec) != 3)
+                    die("size=bimodal needs A:B:P");
+            } else if (strncmp(p, "power:", 6) == 0) {
+                ph->size_kind = SIZE_POWER;
+                n = parse_nums(p + 6, v, 3, spec);
+                if (n != 3 || v[0] < 1 || v[1] <= v[0] || v[2] <= 0)
+                    die("size=power needs A:B:S with 1 <= A < B and S > 0");
+            } else {
+                die("unknown size model in %s", spec);
+            }
+            ph->size_a = v[0];
+            ph->size_b = v[1];
+            ph->size_p = v[2];
+        } else if (strncmp(p, "life=", 5) == 0) {
+            p += 5;
+            v[1] = 0;
+            if (strncmp(p, "exp:", 4) == 0) {
+                ph->life_kind = LIFE_EXP;
+                parse_nums(p + 4, v, 1, spec);
+            } else if (strncmp(p, "fixed:", 6) == 0) {
+                ph->life_kind = LIFE_FIXED;
+                parse_nums(p + 6, v, 1, spec);
+            } else if (strncmp(p, "lifo:", 5) == 0) {
+                ph->life_kind = LIFE_LIFO;
+                parse_nums(p + 5, v, 1, spec);
+            } else if (strncmp(p, "prodcons:", 9) == 0) {
+                ph->life_kind = LIFE_PRODCONS;
+                if (parse_nums(p + 9, v, 2, spec) != 2)
+                    die("life=prodcons needs B:D");
+            } else if (strncmp(p, "forever", 7) == 0) {
+                ph->life_kind = LIFE_FOREVER;
+                v[0] = 1;
+            } else {
+                die("unknown lifetime model in %s", spec);
+            }
+            if (v[0] < 1)
+                die("lifetimes must be at least 1 in %s", spec);
+            ph->life_a = v[0];
+            ph->life_b = v[1];
+        } else if (strncmp(p, "realloc=", 8) == 0) {
+            if (parse_nums(p + 8, v, 3, spec) != 3 || v[1] <= 1)
+                die("realloc needs P:F:MAX with F > 1");
+            ph->realloc_p = v[0];
+            ph->realloc_factor = v[1];
+            ph->realloc_max = v[2];
+        } else if (strncmp(p, "calloc=", 7) == 0) {
+            parse_nums(p + 7, v, 1, spec);
+            if (v[0] < 0 || v[0] > 1)
+                die("calloc needs a probability P in %s", spec);
+            ph->calloc_p = v[0];
+        } else if (strncmp(p, "batch=", 6) == 0) {
+            parse_nums(p + 6, v, 1, spec);
+            if (v[0] < 1 || v[0] > 65536)
+                die("batch needs a size N from 1 to 65536 in %s", spec);
+            ph->batch = (int)v[0];
+        } else if (strncmp(p, "align=", 6) == 0) {
+            if (parse_nums(p + 6, v, 2, spec) != 2 || v[0] < 0 || v[0] > 1 ||
+                v[1] < sizeof(void *) || v[1] > (1 << 20) ||
+                ((uint32_t)v[1] & ((uint32_t)v[1] - 1)) != 0)
+                die("align needs P:A with A a power of two from %zu to 1M",
+                    sizeof(void *));
+            ph->align_p = v[0];
+            ph->align = (uint32_t)v[1];
+        } else if (strncmp(p, "sized=", 6) == 0) {
+            parse_nums(p + 6, v, 1, spec);
+            if (v[0] < 0 || v[0] > 1)
+                die("sized needs a probability P in %s", spec);
+            ph->sized_p = v[0];
+        } else {
+            die("unknown key in %s", spec);
+        }
+        p = strchr(p, ',');
+        p = p ? p + 1 : "";
+    }
+}
+
+/*
+ * write_text - Write the trace in the .rep text format
+ */
+static void write_text(FILE *out, int weight)
+{
+    long i;
+
+    fprintf(out, "%d\n%d\n%ld\n%d\n", weight, num_ids, num_ops, 0);
+    for (i = 0; i < num_ops; i++) {
+        switch (ops[i].type) {
+        case ALLOC:
+            fprintf(out, "a %d %u\n", ops[i].index, ops[i].size);
+            break;
+        case CALLOC:
+            fprintf(out, "c %d %u\n", ops[i].index, ops[i].size);
+            break;
+        case BATCH:
+            fprintf(out, "b %u\n", ops[i].size);
+            break;
+        case REALLOC:
+            fprintf(out, "r %d %u\n", ops[i].index, ops[i].size);
+            break;
+        case ALIGNED:
+            /* m, p or A by the ALIGN_* kind in the index */
+            fprintf(out, "%c %u\n", "mpA"[ops[i].index], ops[i].size);
+            break;
+        case FREE_SIZED:
+            fprintf(out, "s %d %u\n", ops[i].index, ops[i].size);
+            break;
+        default:
+            fprintf(out, "f %d\n", ops[i].index);
+        }
+    }
+}
+
+/*
+ * write_binary - Write the trace in the binary format of tracefmt.h
+ */
+static void write_binary(FILE *out, int weight)
+{
+    tracehdr_t hdr;
+
+    hdr.magic = TRACE_MAGIC;
+    hdr.version = TRACE_VERSION;
+    hdr.weight = weight;
+    hdr.num_ids = num_ids;
+    hdr.num_ops = num_ops;
+    hdr.ignore_ranges = 0;
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1 ||
+        fwrite(ops, sizeof(*ops), num_ops, out) != (size_t)num_ops)
+        die("write failed: %s", strerror(errno));
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: tracegen [-b] [-s seed] [-w weight] [-o file] "
+            "-p phase [-p phase...]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-p <spec>  Add a phase, e.g. "
+            "n=100000,size=power:16:4096:1.5,life=exp:500\n");
+    fprintf(stderr, "\t-s <seed>  Seed of the random generator (default 1).\n");
+    fprintf(stderr, "\t-w <n>     Weight written to the trace header (default 1).\n");
+    fprintf(stderr, "\t-o <file>  Write the trace to <file> instead of stdout.\n");
+    fprintf(stderr, "\t-b         Write the binary format instead of text.\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+}
+
+int main(int argc, char **argv)
+{
+    phase_t phases[MAXPHASES];
+    int num_phases = 0, binary = 0, weight = 1, i, c;
+    unsigned long long seed = 1;
+    const char *outname = NULL;
+    FILE *out = stdout;
+    long tick = 0;
+
+    while ((c = getopt(argc, argv, "bhp:s:w:o:")) != -1) {
+        switch (c) {
+        case 'b':
+            binary = 1;
+            break;
+        case 'p':
+            if (num_phases == MAXPHASES)
+                die("at most %d phases", MAXPHASES);
+            parse_phase(&phases[num_phases++], optarg);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'w':
+            weight = atoi(optarg);
+            break;
+        case 'o':
+            outname = optarg;
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (num_phases == 0) {
+        usage();
+        exit(1);
+    }
+
+    /* A zero state would stay zero */
+    rng_state = seed * 0x9E3779B97F4A7C15ull + 1;
+
+    for (i = 0; i < num_phases; i++)
+        run_phase(&phases[i], &tick);
+
+    /* Free everything still live, earliest deadline first */
+    while (heap_len > 0)
+        release(pop_deadline());
+    while (stack_len > 0)
+        release(stack[--stack_len]);
+    while (queue_len > 0) {
+        release(queue[queue_head++]);
+        queue_len--;
+    }
+    if (num_ids > TRACE_MAX_IDS || num_ops > INT32_MAX)
+        die("trace too large: %d ids, %ld requests", num_ids, num_ops);
+
+    if (outname != NULL && (out = fopen(outname, "w")) == NULL)
+        die("could not open %s: %s", outname, strerror(errno));
+    if (binary)
+        write_binary(out, weight);
+    else
+        write_text(out, weight);
+    if (fclose(out) != 0)
+        die("write failed: %s", strerror(errno));
+
+    fprintf(stderr, "%ld requests on %d blocks\n", num_ops, num_ids);
+    return 0;
+}